@@ -0,0 +1,192 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2015 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file test_cpu_depth_fast_math.cpp Compare the fast math mode of the CPU depth packet processor with the exact mode. */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include <libfreenect2/packet_pipeline.h>
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/protocol/response.h>
+
+/** Keeps a copy of the last depth frame. */
+class DepthCopyListener : public libfreenect2::FrameListener
+{
+public:
+  std::vector<float> depth;
+
+  virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+  {
+    if(type == libfreenect2::Frame::Depth)
+    {
+      const float *data = reinterpret_cast<const float *>(frame->data);
+      depth.assign(data, data + frame->width * frame->height);
+    }
+    return false;
+  }
+};
+
+bool loadBufferFromFile(const std::string& filename, std::vector<unsigned char> &buffer)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  return in.good() || in.eof();
+}
+
+/**
+ * Load the tables into \a processor. The x/z tables use nominal IR camera
+ * parameters without distortion, which is sufficient to compare two modes.
+ */
+void setupProcessor(libfreenect2::DepthPacketProcessor &processor, std::vector<unsigned char> &p0tables, bool fast_math)
+{
+  const double fx = 365.0, fy = 365.0, cx = 256.0, cy = 212.0;
+  const size_t table_size = 512 * 424;
+  std::vector<float> xtable(table_size), ztable(table_size);
+
+  for(size_t i = 0; i < table_size; i++)
+  {
+    double xu = (i % 512 + 0.5 - cx) / fx;
+    double yu = (i / 512 + 0.5 - cy) / fy;
+    xtable[i] = 8192 * xu;
+    ztable[i] = 6250.0 / 3 / std::sqrt(xu * xu + yu * yu + 1);
+  }
+
+  std::vector<short> lut(2048);
+  short y = 0;
+  for(int x = 0; x < 1024; x++)
+  {
+    unsigned inc = 1 << (x / 128 - (x >= 128));
+    lut[x] = y;
+    lut[1024 + x] = -y;
+    y += inc;
+  }
+  lut[1024] = 32767;
+
+  libfreenect2::DepthPacketProcessor::Config config;
+  config.MaxDepth = 18.75f; // compare the whole range of the sensor
+  config.EnableFastMath = fast_math;
+
+  processor.setConfiguration(config);
+  processor.loadXZTables(&xtable[0], &ztable[0]);
+  processor.loadLookupTable(&lut[0]);
+  processor.loadP0TablesFromCommandResponse(&p0tables[0], p0tables.size());
+}
+
+/**
+ * Usage: test_cpu_depth_fast_math <p0 tables response> <depth packet>...
+ *
+ * The p0 tables file is the raw P0 tables command response of a device, each
+ * depth packet file is one raw depth packet (10 sub images of 352x424 words).
+ * Prints the worst case depth difference of the fast math mode in millimeters.
+ *
+ * The processors are taken from two CpuPacketPipeline instances, so only the
+ * exported pipeline classes are linked; the processor is driven through its
+ * virtual interface.
+ */
+int main(int argc, char **argv)
+{
+  if(argc < 3)
+  {
+    std::cerr << "Usage: " << argv[0] << " <p0 tables response> <depth packet>..." << std::endl;
+    return -1;
+  }
+
+  std::vector<unsigned char> p0tables;
+  if(!loadBufferFromFile(argv[1], p0tables) || p0tables.size() < sizeof(libfreenect2::protocol::P0TablesResponse))
+  {
+    std::cerr << "failed to load p0 tables from " << argv[1] << std::endl;
+    return -1;
+  }
+
+  libfreenect2::CpuPacketPipeline exact_pipeline, fast_pipeline;
+  libfreenect2::DepthPacketProcessor &exact_processor = *exact_pipeline.getDepthPacketProcessor();
+  libfreenect2::DepthPacketProcessor &fast_processor = *fast_pipeline.getDepthPacketProcessor();
+  DepthCopyListener exact_listener, fast_listener;
+
+  setupProcessor(exact_processor, p0tables, false);
+  setupProcessor(fast_processor, p0tables, true);
+  exact_processor.setFrameListener(&exact_listener);
+  fast_processor.setFrameListener(&fast_listener);
+
+  double max_diff = 0;
+  size_t valid_pixels = 0, validity_changes = 0, differing_pixels = 0;
+  int result = 0;
+
+  for(int i = 2; i < argc; ++i)
+  {
+    std::vector<unsigned char> buffer;
+    if(!loadBufferFromFile(argv[i], buffer) || buffer.size() < 352 * 424 * 10 * 2)
+    {
+      std::cerr << "failed to load depth packet from " << argv[i] << std::endl;
+      result = -1;
+      continue;
+    }
+
+    libfreenect2::DepthPacket packet;
+    packet.sequence = i;
+    packet.timestamp = 0;
+    packet.buffer = &buffer[0];
+    packet.buffer_length = buffer.size();
+    packet.memory = 0;
+
+    exact_processor.process(packet);
+    fast_processor.process(packet);
+
+    double packet_max_diff = 0;
+
+    for(size_t j = 0; j < exact_listener.depth.size(); ++j)
+    {
+      float exact = exact_listener.depth[j], fast = fast_listener.depth[j];
+
+      if((exact > 0) != (fast > 0))
+      {
+        validity_changes++;
+        continue;
+      }
+
+      if(exact <= 0) continue;
+
+      valid_pixels++;
+      double diff = std::abs(double(exact) - fast);
+      packet_max_diff = std::max(packet_max_diff, diff);
+      differing_pixels += diff > 0;
+    }
+
+    std::cout << argv[i] << ": max depth difference " << packet_max_diff << " mm" << std::endl;
+    max_diff = std::max(max_diff, packet_max_diff);
+  }
+
+  std::cout << "worst case depth difference: " << max_diff << " mm" << std::endl;
+  std::cout << "differing pixels: " << differing_pixels << " of " << valid_pixels << " valid pixels" << std::endl;
+  std::cout << "pixels changing validity: " << validity_changes << std::endl;
+
+  return result;
+}
@@ -29,6 +29,7 @@
 #ifndef ASYNC_PACKET_PROCESSOR_H_
 #define ASYNC_PACKET_PROCESSOR_H_
 
+#include <deque>
 #include <libfreenect2/threading.h>
 #include <libfreenect2/packet_processor.h>
 
@@ -37,6 +38,9 @@ namespace libfreenect2
 
 /**
  * Packet processor that runs asynchronously.
+ *
+ * Packets wait in a queue while an earlier packet is processed. The buffer of
+ * a packet is released once it is processed or dropped.
  * @tparam PacketT Type of the packet being processed.
  */
 template<typename PacketT>
@@ -45,56 +49,119 @@ class AsyncPacketProcessor : public PacketProcessor<PacketT>
 public:
   typedef PacketProcessor<PacketT>* PacketProcessorPtr;
 
+  /** Counters of the packets passed to the processor. */
+  struct Counters
+  {
+    size_t processed;      ///< Packets processed.
+    size_t dropped_newest; ///< New packets refused by ready() because the queue was full.
+    size_t dropped_oldest; ///< Waiting packets dropped to make room for a new one.
+    size_t max_in_flight;  ///< Most packets waiting or being processed at once.
+  };
+
   /**
    * Constructor.
    * @param processor Object performing the processing.
    */
   AsyncPacketProcessor(PacketProcessorPtr processor) :
     processor_(processor),
-    current_packet_available_(false),
+    max_in_flight_(1),
+    drop_oldest_(false),
+    processing_(false),
     shutdown_(false),
     thread_(&AsyncPacketProcessor<PacketT>::static_execute, this)
   {
+    counters_.processed = 0;
+    counters_.dropped_newest = 0;
+    counters_.dropped_oldest = 0;
+    counters_.max_in_flight = 0;
   }
 
   virtual ~AsyncPacketProcessor()
   {
-    shutdown_ = true;
+    {
+      libfreenect2::lock_guard l(packet_mutex_);
+      shutdown_ = true;
+    }
     packet_condition_.notify_one();
 
     thread_.join();
+
+    dropQueue();
   }
 
-  virtual bool ready()
+  /**
+   * Set the number of packets that may wait or be processed at once, and what
+   * happens to a new packet if there are that many. Drops the waiting packets
+   * and blocks until the current packet is processed.
+   * @param max_in_flight Usually one less than the buffers of the parser.
+   * @param drop_oldest Drop the oldest waiting packet instead of the new one.
+   */
+  void setQueue(size_t max_in_flight, bool drop_oldest)
   {
-    // try to aquire lock, if we succeed the background thread is waiting on packet_condition_
-    bool locked = packet_mutex_.try_lock();
+    libfreenect2::unique_lock l(packet_mutex_);
 
-    if(locked)
+    dropQueue();
+    while(processing_)
     {
-      packet_mutex_.unlock();
+      WAIT_CONDITION(idle_condition_, packet_mutex_, l);
     }
 
-    return locked;
+    max_in_flight_ = (max_in_flight > 1) ? max_in_flight : 1;
+    drop_oldest_ = drop_oldest;
+  }
+
+  /** Get the counters, they are consistent with each other. */
+  Counters getCounters()
+  {
+    libfreenect2::lock_guard l(packet_mutex_);
+    return counters_;
+  }
+
+  virtual bool ready()
+  {
+    libfreenect2::lock_guard l(packet_mutex_);
+
+    const size_t in_flight = queue_.size() + (processing_ ? 1 : 0);
+    bool room = in_flight < max_in_flight_ || (drop_oldest_ && !queue_.empty());
+
+    if(!room)
+      counters_.dropped_newest++;
+
+    return room;
   }
 
   virtual void process(const PacketT &packet)
   {
     {
       libfreenect2::lock_guard l(packet_mutex_);
-      current_packet_ = packet;
-      current_packet_available_ = true;
+
+      if(queue_.size() + (processing_ ? 1 : 0) >= max_in_flight_ && !queue_.empty())
+      {
+        BufferRing::release(queue_.front().memory);
+        queue_.pop_front();
+        counters_.dropped_oldest++;
+      }
+
+      queue_.push_back(packet);
+
+      const size_t in_flight = queue_.size() + (processing_ ? 1 : 0);
+      if(in_flight > counters_.max_in_flight)
+        counters_.max_in_flight = in_flight;
     }
     packet_condition_.notify_one();
   }
 private:
   PacketProcessorPtr processor_;  ///< The processing routine, executed in the asynchronous thread.
-  bool current_packet_available_; ///< Whether #current_packet_ still needs processing.
-  PacketT current_packet_;        ///< Packet being processed.
+  std::deque<PacketT> queue_;     ///< Packets waiting to be processed, oldest first.
+  size_t max_in_flight_;          ///< Limit of waiting packets plus the one being processed.
+  bool drop_oldest_;              ///< Overflow policy, see setQueue().
+  bool processing_;               ///< Whether a packet is being processed.
+  Counters counters_;
 
   bool shutdown_;
-  libfreenect2::mutex packet_mutex_; ///< Mutex indicating a new packet can be stored in #current_packet_.
-  libfreenect2::condition_variable packet_condition_; ///< Mutex indicating processing is blocked on lack of packets.
+  libfreenect2::mutex packet_mutex_; ///< Mutex guarding the queue and the counters.
+  libfreenect2::condition_variable packet_condition_; ///< Condition signaling a new packet or shutdown.
+  libfreenect2::condition_variable idle_condition_; ///< Condition signaling the end of processing a packet.
   libfreenect2::thread thread_; ///< Asynchronous thread.
 
   /**
@@ -106,22 +173,48 @@ private:
     static_cast<AsyncPacketProcessor<PacketT> *>(data)->execute();
   }
 
-  /** Asynchronously process a provided packet. */
-  void execute()
+  /** Release the buffers of all waiting packets, the mutex must be held. */
+  void dropQueue()
   {
-    libfreenect2::unique_lock l(packet_mutex_);
-
-    while(!shutdown_)
+    while(!queue_.empty())
     {
-      WAIT_CONDITION(packet_condition_, packet_mutex_, l);
+      BufferRing::release(queue_.front().memory);
+      queue_.pop_front();
+    }
+  }
 
-      if(current_packet_available_)
+  /** Asynchronously process the queued packets. */
+  void execute()
+  {
+    for(;;)
+    {
+      PacketT packet;
       {
-        // invoke process impl
-        processor_->process(current_packet_);
+        libfreenect2::unique_lock l(packet_mutex_);
+
+        while(!shutdown_ && queue_.empty())
+        {
+          WAIT_CONDITION(packet_condition_, packet_mutex_, l);
+        }
 
-        current_packet_available_ = false;
+        if(shutdown_)
+          break;
+
+        packet = queue_.front();
+        queue_.pop_front();
+        processing_ = true;
+      }
+
+      // invoke process impl
+      processor_->process(packet);
+      BufferRing::release(packet.memory);
+
+      {
+        libfreenect2::lock_guard l(packet_mutex_);
+        processing_ = false;
+        counters_.processed++;
       }
+      idle_condition_.notify_all();
     }
   }
 };
@@ -24,17 +24,21 @@
  * either License.
  */
 
-/** @file double_buffer.h Double buffer implementation. */
+/** @file buffer_ring.h Ring of packet buffers. */
 
-#ifndef DOUBLE_BUFFER_H_
-#define DOUBLE_BUFFER_H_
+#ifndef BUFFER_RING_H_
+#define BUFFER_RING_H_
 
 #include <stddef.h>
+#include <vector>
 #include <libfreenect2/config.h>
+#include <libfreenect2/threading.h>
 
 namespace libfreenect2
 {
 
+class BufferRing;
+
 /** Data of a single buffer. */
 struct Buffer
 {
@@ -42,28 +46,40 @@ public:
   size_t capacity; ///< Capacity of the buffer.
   size_t length;   ///< Used length of the buffer.
   unsigned char* data; ///< Start address of the buffer.
+  BufferRing *ring; ///< Ring the buffer is released to, or 0 if it is not part of a ring.
 };
 
-/** Double bufffer class. */
-class DoubleBuffer
+/**
+ * Ring of equally sized packet buffers.
+ *
+ * A stream parser assembles a packet in the front buffer, then hands the
+ * buffer over with the packet and continues with a free buffer. Whoever
+ * holds a handed over buffer releases it once it no longer reads it, so
+ * several packets can wait for a busy processor.
+ */
+class BufferRing
 {
 public:
-  DoubleBuffer();
-  virtual ~DoubleBuffer();
+  BufferRing();
+  virtual ~BufferRing();
 
-  void allocate(size_t buffer_size);
+  void allocate(size_t buffer_size, size_t count);
 
-  void swap();
+  size_t size() const;
 
   Buffer& front();
 
-  Buffer& back();
+  bool next();
+
+  static void release(Buffer *buffer);
 private:
-  Buffer buffer_[2]; // Both data buffers.
-  unsigned char front_buffer_index_; ///< Index of the front buffer.
+  std::vector<Buffer> buffer_; ///< All buffers.
+  std::vector<bool> in_use_;   ///< Whether a buffer is the front buffer or handed over.
+  size_t front_buffer_index_;  ///< Index of the front buffer.
 
-  unsigned char* buffer_data_; ///< Memory holding both buffers.
+  unsigned char* buffer_data_; ///< Memory holding all buffers.
+  libfreenect2::mutex mutex_;  ///< Guards #in_use_.
 };
 
 } /* namespace libfreenect2 */
-#endif /* DOUBLE_BUFFER_H_ */
+#endif /* BUFFER_RING_H_ */
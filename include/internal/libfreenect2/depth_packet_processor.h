@@ -47,6 +47,7 @@ struct DepthPacket
   uint32_t timestamp;
   unsigned char *buffer; ///< Depth data.
   size_t buffer_length;  ///< Size of depth data.
+  Buffer *memory;        ///< Parser buffer holding the data, released once the packet is processed.
 };
 
 /** Class for processing depth information. */
@@ -94,19 +95,54 @@ public:
     Parameters();
   };
 
+  /**
+   * Location of the measurements of each pixel in a raw depth packet.
+   * The 11-bit measurement of pixel (x, y) in sub image s starts at bit
+   * column_bit[x] of the 16-bit word s * sub_image_words + row_offset[y].
+   * The processors only read the packet through this table, so a different
+   * raw layout only needs a different table.
+   */
+  struct DecodeTable
+  {
+    static const uint32_t INVALID_COLUMN = 0xffffffff; ///< Column without a measurement.
+
+    uint32_t sub_image_words;  ///< Number of 16-bit words per sub image.
+    uint32_t row_offset[424];  ///< Word offset of row y within a sub image.
+    uint32_t column_bit[512];  ///< Bit offset of column x within its row, or INVALID_COLUMN.
+
+    /** Layout of the Kinect v2: 352 words per row, rows stored from the middle outwards. */
+    DecodeTable();
+  };
+
   DepthPacketProcessor();
   virtual ~DepthPacketProcessor();
 
   virtual void setFrameListener(libfreenect2::FrameListener *listener);
   virtual void setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config);
 
+  /** Whether Config::EnableBinning gives 256x212 frames, the default ignores it and outputs 512x424. */
+  virtual bool supportsBinning() const;
+
+  /** Number of scratch heap allocations made by the last process() call, the default has no scratch arena and returns 0. */
+  virtual size_t getFrameHeapAllocations() const;
+
   virtual void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length) = 0;
 
   static const size_t TABLE_SIZE = 512*424;
+  static const size_t BINNED_TABLE_SIZE = 256*212;
   static const size_t LUT_SIZE = 2048;
   virtual void loadXZTables(const float *xtable, const float *ztable) = 0;
   virtual void loadLookupTable(const short *lut) = 0;
 
+  /**
+   * Compute the x and z tables of the 256x212 pixels of Config::EnableBinning.
+   * A binned pixel gets the average of its 2x2 pixels, and is invalid (z = 0)
+   * if any of them is.
+   * @param xtable, ztable Tables of TABLE_SIZE entries.
+   * @param [out] binned_xtable, binned_ztable Tables of BINNED_TABLE_SIZE entries.
+   */
+  static void binXZTables(const float *xtable, const float *ztable, float *binned_xtable, float *binned_ztable);
+
 protected:
   libfreenect2::DepthPacketProcessor::Config config_;
   libfreenect2::FrameListener *listener_;
@@ -141,9 +177,19 @@ class CpuDepthPacketProcessorImpl;
 class CpuDepthPacketProcessor : public DepthPacketProcessor
 {
 public:
-  CpuDepthPacketProcessor();
+  /**
+   * Scratch memory is allocated once. Set the environment variable
+   * LIBFREENECT2_CPU_HUGE_PAGES=1 to back it with huge pages.
+   * @param num_threads Number of threads processing horizontal bands of the image in parallel.
+   * 1 processes on the calling thread only, 0 or less uses one thread per hardware thread.
+   * @param pipeline_stages Number of stages (1 to 3) processing consecutive frames concurrently, one
+   * thread each. With 2 or 3 stages, process() returns after the first stage and the last stage
+   * passes the frames to the listener on its own thread, in order. \a num_threads is then ignored.
+   */
+  CpuDepthPacketProcessor(const int num_threads = 1, const int pipeline_stages = 1);
   virtual ~CpuDepthPacketProcessor();
   virtual void setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config);
+  virtual bool supportsBinning() const;
 
   virtual void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length);
 
@@ -151,6 +197,9 @@ public:
   virtual void loadLookupTable(const short *lut);
 
   virtual void process(const DepthPacket &packet);
+
+  /** Number of scratch heap allocations made by the last process() call, 0 in steady state. */
+  virtual size_t getFrameHeapAllocations() const;
 private:
   CpuDepthPacketProcessorImpl *impl_;
 };
@@ -165,6 +214,7 @@ public:
   OpenCLDepthPacketProcessor(const int deviceId = -1);
   virtual ~OpenCLDepthPacketProcessor();
   virtual void setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config);
+  virtual bool supportsBinning() const;
 
   virtual void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length);
 
@@ -34,7 +34,8 @@
 
 #include <libfreenect2/config.h>
 
-#include <libfreenect2/double_buffer.h>
+#include <libfreenect2/buffer_ring.h>
+#include <libfreenect2/threading.h>
 #include <libfreenect2/depth_packet_processor.h>
 
 #include <libfreenect2/data_callback.h>
@@ -66,16 +67,41 @@ public:
 
   void setPacketProcessor(libfreenect2::BaseDepthPacketProcessor *processor);
 
+  /**
+   * Reallocate the packet buffers, no packet may be in flight.
+   * @param count Number of buffers, at least 2.
+   */
+  void setBufferCount(size_t count);
+
+  /**
+   * Only assemble and process every Nth depth packet, by sequence number.
+   * Skipped packets are not copied and do not wake the processor.
+   * @param decimation N, 1 keeps every packet.
+   */
+  void setDecimation(unsigned int decimation);
+
+  Freenect2Device::StreamStatistics getStatistics() const;
+
   virtual void onDataReceived(unsigned char* buffer, size_t length);
 private:
   libfreenect2::BaseDepthPacketProcessor *processor_;
 
-  libfreenect2::DoubleBuffer buffer_;
+  libfreenect2::BufferRing buffer_;
   libfreenect2::Buffer work_buffer_;
 
   uint32_t processed_packets_;
   uint32_t current_sequence_;
   uint32_t current_subsequence_;
+
+  uint32_t decimation_;
+  bool skip_sequence_;
+  bool skip_subpacket_;
+  bool buffer_full_; ///< All buffers are handed over, sequences are dropped until one is released.
+
+  uint32_t next_subsequence_;
+  uint32_t direct_subsequence_;
+
+  Freenect2Device::StreamStatistics statistics_; ///< Written by onDataReceived() with atomicAdd() and atomicStore().
 };
 
 } /* namespace libfreenect2 */
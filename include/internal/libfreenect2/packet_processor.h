@@ -29,6 +29,8 @@
 #ifndef PACKET_PROCESSOR_H_
 #define PACKET_PROCESSOR_H_
 
+#include <libfreenect2/buffer_ring.h>
+
 namespace libfreenect2
 {
 
@@ -66,7 +68,10 @@ public:
   NoopPacketProcessor() {}
   virtual ~NoopPacketProcessor() {}
 
-  virtual void process(const PacketT &packet) {}
+  virtual void process(const PacketT &packet)
+  {
+    BufferRing::release(packet.memory);
+  }
 };
 
 /**
@@ -34,6 +34,7 @@
 
 #include <libfreenect2/config.h>
 #include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/libfreenect2.hpp>
 #include <libfreenect2/packet_processor.h>
 
 namespace libfreenect2
@@ -51,6 +52,7 @@ struct RgbPacket
   float gain;
   float gamma;
 
+  Buffer *memory; ///< Parser buffer holding the data, released once the packet is processed.
 };
 
 typedef PacketProcessor<RgbPacket> BaseRgbPacketProcessor;
@@ -63,11 +65,17 @@ public:
   virtual ~RgbPacketProcessor();
 
   virtual void setFrameListener(libfreenect2::FrameListener *listener);
+
+  /** Apply the color settings of \a config, as validated by Freenect2Device. The default ignores them. */
+  virtual void setConfiguration(const libfreenect2::Freenect2Device::Config &config);
 protected:
+  /** Pass the JPEG data of \a packet to the listener undecoded, as a Frame::Raw color frame. */
+  void deliverRaw(const libfreenect2::RgbPacket &packet);
+
   libfreenect2::FrameListener *listener_;
 };
 
-/** Class for dumping the JPEG information, eg to file. */
+/** Processor passing the JPEG data on undecoded as Frame::Raw color frames, e.g. for recording. */
 class DumpRgbPacketProcessor : public RgbPacketProcessor
 {
 public:
@@ -79,12 +87,19 @@ protected:
 
 class TurboJpegRgbPacketProcessorImpl;
 
-/** Processor to decode JPEG to image, using TurboJpeg. */
+/** Processor to decode JPEG to image, using TurboJpeg. Passes the JPEG on undecoded if the listener asks for Frame::Raw. */
 class TurboJpegRgbPacketProcessor : public RgbPacketProcessor
 {
 public:
-  TurboJpegRgbPacketProcessor();
+  /**
+   * @param num_decoders Number of JPEG images decoded concurrently by a pool of threads.
+   * 1 decodes in the calling thread, 0 uses all hardware threads.
+   */
+  TurboJpegRgbPacketProcessor(const int num_decoders = 1);
   virtual ~TurboJpegRgbPacketProcessor();
+
+  /** Decode the region Config::ColorRoiX etc. at 1/Config::ColorDownscale of full resolution. */
+  virtual void setConfiguration(const libfreenect2::Freenect2Device::Config &config);
 protected:
   virtual void process(const libfreenect2::RgbPacket &packet);
 private:
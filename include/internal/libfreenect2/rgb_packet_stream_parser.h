@@ -32,7 +32,9 @@
 #include <stddef.h>
 
 #include <libfreenect2/config.h>
-#include <libfreenect2/double_buffer.h>
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/buffer_ring.h>
+#include <libfreenect2/threading.h>
 #include <libfreenect2/rgb_packet_processor.h>
 
 #include <libfreenect2/data_callback.h>
@@ -49,10 +51,24 @@ public:
 
   void setPacketProcessor(BaseRgbPacketProcessor *processor);
 
+  /**
+   * Reallocate the packet buffers, no packet may be in flight.
+   * @param count Number of buffers, at least 2.
+   */
+  void setBufferCount(size_t count);
+
+  Freenect2Device::StreamStatistics getStatistics() const;
+
   virtual void onDataReceived(unsigned char* buffer, size_t length);
 private:
-  libfreenect2::DoubleBuffer buffer_; ///< Buffers for storage.
+  void countSequence(uint32_t sequence);
+
+  libfreenect2::BufferRing buffer_; ///< Buffers for storage.
   BaseRgbPacketProcessor *processor_; ///< Parser implementation.
+
+  uint32_t last_sequence_; ///< Sequence number of the last received packet.
+  bool buffer_full_; ///< All buffers are handed over, packets are dropped until one is released.
+  Freenect2Device::StreamStatistics statistics_; ///< Written by onDataReceived() with atomicAdd() and atomicStore().
 };
 
 } /* namespace libfreenect2 */
@@ -94,5 +94,46 @@ using namespace tthread::this_thread;
 
 #endif
 
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace libfreenect2
+{
+
+/** Add \a delta to a counter that other threads read with atomicLoad(). */
+inline void atomicAdd(uint32_t &value, uint32_t delta)
+{
+#ifdef _MSC_VER
+  _InterlockedExchangeAdd(reinterpret_cast<volatile long *>(&value), static_cast<long>(delta));
+#else
+  __sync_fetch_and_add(&value, delta);
+#endif
+}
+
+/** Set a counter that other threads read with atomicLoad(). */
+inline void atomicStore(uint32_t &value, uint32_t new_value)
+{
+#ifdef _MSC_VER
+  _InterlockedExchange(reinterpret_cast<volatile long *>(&value), static_cast<long>(new_value));
+#else
+  __sync_lock_test_and_set(&value, new_value);
+  __sync_synchronize();
+#endif
+}
+
+/** Read a counter written with atomicAdd() or atomicStore() by another thread. */
+inline uint32_t atomicLoad(const uint32_t &value)
+{
+#ifdef _MSC_VER
+  return static_cast<uint32_t>(_InterlockedCompareExchange(reinterpret_cast<volatile long *>(const_cast<uint32_t *>(&value)), 0, 0));
+#else
+  return __sync_fetch_and_add(const_cast<uint32_t *>(&value), 0);
+#endif
+}
+
+} /* libfreenect2 */
 
 #endif /* THREADING_H_ */
@@ -47,18 +47,35 @@ class LIBFREENECT2_API Frame
   /** Available types of frames. */
   enum Type
   {
-    Color = 1, ///< 1920x1080 32-bit BGRX.
-    Ir = 2,    ///< 512x424 float. Range is [0.0, 65535.0].
-    Depth = 4  ///< 512x424 float, unit: millimeter. Non-positive, NaN, and infinity are invalid or missing data.
+    Color = 1, ///< 1920x1080 32-bit BGRX, or RGBX, RGB, Gray, I420, or the undecoded JPEG as Raw if the listener asks for it. Smaller if Freenect2Device::Config::ColorDownscale or ColorRoiWidth is set.
+    Ir = 2,    ///< 512x424 float, or uint16 if the listener asks for Format::UInt16. Range is [0.0, 65535.0].
+    Depth = 4, ///< 512x424 float, unit: millimeter. Non-positive, NaN, and infinity are invalid or missing data. As uint16, 0 is invalid.
+    Confidence = 8 ///< 512x424 1-byte bitmask of #ConfidenceFlag, one per depth pixel. Only sent to listeners which want it (CPU and OpenCL).
   };
 
-  /** (Proposed for 0.2) Pixel format. */
+  /** Bits of the pixels of Confidence frames. */
+  enum ConfidenceFlag
+  {
+    DepthValid = 1,   ///< The depth of the pixel is valid.
+    LowAmplitude = 2, ///< The IR amplitude is too low for depth, or the pixel is not covered by the sensor.
+    Ambiguous = 4,    ///< The phases of the three frequencies do not agree on a distance.
+    OutOfRange = 8,   ///< The depth is outside of the configured depth range.
+    Edge = 16,        ///< Removed by the edge tests of the bilateral or edge aware filter.
+    Saturated = 32    ///< The IR amplitude of a frequency is saturated (CPU only).
+  };
+
+  /** Pixel format. */
   enum Format
   {
-    BGRX,
-    RGBX,
-    Gray,
-    Float
+    Invalid = 0, ///< Invalid format.
+    BGRX = 1,    ///< 4 bytes of B, G, R, and unused per pixel.
+    RGBX = 2,    ///< 4 bytes of R, G, B, and unused per pixel.
+    Gray = 3,    ///< 1 byte of gray per pixel.
+    Float = 4,   ///< A 4-byte float per pixel.
+    UInt16 = 5,  ///< A 2-byte unsigned integer per pixel, rounded and clamped to [0, 65535].
+    RGB = 6,     ///< 3 bytes of R, G, and B per pixel.
+    I420 = 7,    ///< 1 byte of luma per pixel, followed by the U and V planes of half the width and height.
+    Raw = 8      ///< Compressed data of #width bytes, the height and bytes per pixel are 1. The JPEG image for color frames.
   };
 
   size_t width;           ///< Length of a line (in pixels).
@@ -71,7 +88,11 @@ class LIBFREENECT2_API Frame
   float gain;             ///< From 1.0 (bright) to 1.5 (covered)
   float gamma;            ///< From 1.0 (bright) to 6.4 (covered)
   uint32_t status;        ///< Reserved. To be defined in 0.2.
-  Format format;          ///< Reserved. To be defined in 0.2.
+  Format format;          ///< Pixel format of #data.
+  size_t x_offset;        ///< Column of the first pixel in the uncropped image, see Freenect2Device::Config::ColorRoiX.
+  size_t y_offset;        ///< Line of the first pixel in the uncropped image.
+  size_t full_width;      ///< Width of the uncropped image, #width unless the frame is cropped.
+  size_t full_height;     ///< Height of the uncropped image, #height unless the frame is cropped.
 
   /** Construct a new frame.
    * @param width Width in pixel
@@ -87,6 +108,12 @@ class LIBFREENECT2_API Frame
     exposure(0.f),
     gain(0.f),
     gamma(0.f),
+    status(0),
+    format(Invalid),
+    x_offset(0),
+    y_offset(0),
+    full_width(width),
+    full_height(height),
     rawdata(NULL)
   {
     if (data_)
@@ -123,6 +150,22 @@ public:
    * @return true if you want to take ownership of the frame, i.e. reuse/delete it. Will be reused/deleted by caller otherwise.
    */
   virtual bool onNewFrame(Frame::Type type, Frame *frame) = 0;
+
+  /**
+   * Pixel format the listener wants for frames of a type. Processors which
+   * do not support the format send frames in their default format.
+   * @param type Type of the frames.
+   * @return Frame::BGRX for color frames and Frame::Float for IR and depth frames by default.
+   */
+  virtual Frame::Format getFrameFormat(Frame::Type type) const;
+
+  /**
+   * Whether the listener wants frames of a type. Processors may skip
+   * computing, and do not send, frames nobody wants.
+   * @param type Type of the frames.
+   * @return true by default, except for Frame::Confidence.
+   */
+  virtual bool wantsFrameType(Frame::Type type) const;
 };
 
 } /* namespace libfreenect2 */
@@ -72,7 +72,17 @@ public:
   /** Shortcut to delete all frames */
   void release(FrameMap &frame);
 
+  /**
+   * Ask the processors for frames of \a type in \a format, e.g. Frame::UInt16 for IR and depth.
+   * @see FrameListener::getFrameFormat()
+   */
+  void setFrameFormat(Frame::Type type, Frame::Format format);
+
   virtual bool onNewFrame(Frame::Type type, Frame *frame);
+  virtual Frame::Format getFrameFormat(Frame::Type type) const;
+
+  /** Only the frame types passed to the constructor are wanted. */
+  virtual bool wantsFrameType(Frame::Type type) const;
 private:
   SyncMultiFrameListenerImpl *impl_;
 };
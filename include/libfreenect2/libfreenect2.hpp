@@ -111,6 +111,27 @@ public:
     float p2; ///< Tangential distortion coefficient
   };
 
+  /** Counters of a packet stream since the device was opened.
+   * Each counter is only written by the thread parsing the stream, with an
+   * atomic operation, and is read atomically without locking. The counters
+   * are not read together as one snapshot, so they may be off by a packet
+   * relative to each other.
+   */
+  struct StreamStatistics
+  {
+    uint32_t received;      ///< Packets whose end was received.
+    uint32_t assembled;     ///< Complete and valid packets passed on to the processor.
+    uint32_t decimated;     ///< Complete depth packets skipped because of Config::DepthDecimation.
+    uint32_t busy;          ///< Complete packets skipped because the processor was busy.
+    uint32_t dropped;       ///< Packets dropped because all packet buffers were still held by the processor.
+    uint32_t incomplete;    ///< Depth packets missing subpackets.
+    uint32_t incomplete_mask; ///< Subpackets of the last incomplete depth packet, bit i set if subpacket i was received.
+    uint32_t oversized;     ///< Depth subpackets or color packets larger than their buffer.
+    uint32_t invalid;       ///< Depth subpackets of the wrong length, color packets with mismatching size or sequence or without JPEG data.
+    uint32_t sequence_gaps; ///< Jumps in the sequence numbers of received packets.
+    uint32_t lost;          ///< Sequence numbers skipped by these jumps.
+  };
+
   /** Configuration of depth processing. */
   struct Config
   {
@@ -120,7 +141,63 @@ public:
     bool EnableBilateralFilter; ///< Remove some "flying pixels".
     bool EnableEdgeAwareFilter; ///< Remove pixels on edges because ToF cameras produce noisy edges.
 
-    /** Default is 0.5, 4.5, true, true */
+    bool EnableFastMath;        ///< Use faster approximations of the transcendental functions (CPU and OpenCL). Depth may differ slightly.
+
+    /**
+     * Region of interest of the depth and IR frames in pixels (CPU only).
+     * Only the region and the neighbourhood its filters read are processed,
+     * the other pixels are set to 0. A width or height of 0 selects the whole frame.
+     */
+    int RoiX, RoiY, RoiWidth, RoiHeight;
+
+    /**
+     * Average 2x2 pixels after the first processing stage and output 256x212
+     * depth and IR frames (CPU and OpenCL, other pipelines turn it off). The
+     * region of interest is in binned pixels. Use getScaledIrCameraParams()
+     * for their intrinsics.
+     */
+    bool EnableBinning;
+
+    /**
+     * Smooth depth over time with a per-pixel exponential moving average (CPU and OpenCL).
+     * A pixel starts over from the new depth if that differs from the average by
+     * more than TemporalFilterThreshold. Invalid pixels stay invalid and start over.
+     */
+    bool EnableTemporalFilter;
+    float TemporalFilterAlpha;     ///< Weight of the newest depth in the average, in (0, 1].
+    float TemporalFilterThreshold; ///< Start over above this depth change (meter).
+
+    /**
+     * Only process every Nth depth packet, e.g. 2 for 15 fps or 3 for 10 fps.
+     * Skipped packets are dropped by the stream parser before they are assembled.
+     */
+    int DepthDecimation;
+
+    /**
+     * Number of packet buffers per stream, at least 2. Up to PacketBuffers - 2
+     * packets wait while the processor is busy, so short processing delays do
+     * not drop packets. Takes effect on the next start().
+     */
+    int PacketBuffers;
+    bool DropOldestPacket; ///< When all buffers are in use, drop the oldest waiting packet instead of the newest.
+
+    /**
+     * Decode color frames at 1/ColorDownscale of 1920x1080, one of 1, 2, 4
+     * or 8 for 1920x1080, 960x540, 480x270 or 240x135 (TurboJPEG only).
+     * Use getScaledColorCameraParams() for their intrinsics.
+     */
+    int ColorDownscale;
+
+    /**
+     * Region of interest of the color frames in pixels of the 1920x1080 image
+     * (TurboJPEG only). The region is widened to the MCU grid of the JPEG, at
+     * most 16x16 pixels, and only it is decoded. Frame::x_offset and
+     * Frame::y_offset give the position of the cropped frame, in pixels of the
+     * downscaled image. A width or height of 0 selects the whole frame.
+     */
+    int ColorRoiX, ColorRoiY, ColorRoiWidth, ColorRoiHeight;
+
+    /** Default is 0.5, 4.5, true, true, false, the whole frame, false, false with 0.4 and 0.03, 1, 2, false, 1, and the whole frame */
     Config();
   };
 
@@ -139,6 +216,29 @@ public:
    */
   virtual IrCameraParams getIrCameraParams() = 0;
 
+  /** Get depth parameters of the depth and IR frames of the current
+   * configuration. These are the parameters of getIrCameraParams(), with the
+   * focal length and principal point halved if Config::EnableBinning is set.
+   */
+  virtual IrCameraParams getScaledIrCameraParams() = 0;
+
+  /** Get color parameters of the color frames of the current configuration.
+   * These are the parameters of getColorCameraParams(), with the focal length
+   * divided by Config::ColorDownscale and the principal point moved to the
+   * downscaled pixel grid, (c + 0.5) / ColorDownscale - 0.5.
+   */
+  virtual ColorCameraParams getScaledColorCameraParams() = 0;
+
+  /** Get the statistics of the color stream, can be called at any time.
+   * @copydetails StreamStatistics
+   */
+  virtual StreamStatistics getColorStreamStatistics() = 0;
+
+  /** Get the statistics of the depth stream, can be called at any time.
+   * @copydetails StreamStatistics
+   */
+  virtual StreamStatistics getIrStreamStatistics() = 0;
+
   /** Replace factory preset color camera parameters.
    * We do not have a clear understanding of the meaning of the parameters right now.
    * You probably want to leave it as it is.
@@ -29,6 +29,7 @@
 #ifndef PACKET_PIPELINE_H_
 #define PACKET_PIPELINE_H_
 
+#include <cstddef>
 #include <libfreenect2/config.h>
 
 namespace libfreenect2
@@ -37,6 +38,8 @@ namespace libfreenect2
 class DataCallback;
 class RgbPacketProcessor;
 class DepthPacketProcessor;
+class DepthPacketStreamParser;
+class RgbPacketStreamParser;
 class PacketPipelineComponents;
 
 /** @defgroup pipeline Packet Pipelines
@@ -59,6 +62,21 @@ public:
 
   virtual PacketParser *getRgbPacketParser() const;
   virtual PacketParser *getIrPacketParser() const;
+  virtual RgbPacketStreamParser *getRgbPacketStreamParser() const;
+  virtual DepthPacketStreamParser *getDepthPacketStreamParser() const;
+
+  /**
+   * Set the number of packet buffers per stream and the overflow policy,
+   * see Freenect2Device::Config::PacketBuffers. Only call it while not streaming.
+   */
+  virtual void setPacketBuffers(int count, bool drop_oldest) const;
+
+  /**
+   * Number of scratch heap allocations the depth processor made for the last
+   * frame, 0 in steady state and for processors without a scratch arena.
+   * Can be called while streaming.
+   */
+  virtual size_t getDepthFrameHeapAllocations() const;
 
   virtual RgbPacketProcessor *getRgbPacketProcessor() const;
   virtual DepthPacketProcessor *getDepthPacketProcessor() const;
@@ -69,8 +87,17 @@ protected:
 /** Pipeline with CPU depth processing. */
 class LIBFREENECT2_API CpuPacketPipeline : public PacketPipeline
 {
+protected:
+  const int num_threads_;
+  const int pipeline_stages_;
+  const int color_decoders_;
 public:
-  CpuPacketPipeline();
+  /**
+   * @param num_threads Number of threads used for depth processing. 0 uses all hardware threads.
+   * @param pipeline_stages Number of depth processing stages (1 to 3) working on consecutive frames concurrently.
+   * @param color_decoders Number of color images decoded concurrently. 0 uses all hardware threads.
+   */
+  CpuPacketPipeline(const int num_threads = 1, const int pipeline_stages = 1, const int color_decoders = 1);
   virtual ~CpuPacketPipeline();
 };
 
@@ -81,8 +108,10 @@ class LIBFREENECT2_API OpenGLPacketPipeline : public PacketPipeline
 protected:
   void *parent_opengl_context_;
   bool debug_;
+  const int color_decoders_;
 public:
-  OpenGLPacketPipeline(void *parent_opengl_context = 0, bool debug = false);
+  /** @param color_decoders Number of color images decoded concurrently. 0 uses all hardware threads. */
+  OpenGLPacketPipeline(void *parent_opengl_context = 0, bool debug = false, const int color_decoders = 1);
   virtual ~OpenGLPacketPipeline();
 };
 #endif // LIBFREENECT2_WITH_OPENGL_SUPPORT
@@ -93,8 +122,10 @@ class LIBFREENECT2_API OpenCLPacketPipeline : public PacketPipeline
 {
 protected:
   const int deviceId;
+  const int color_decoders_;
 public:
-  OpenCLPacketPipeline(const int deviceId = -1);
+  /** @param color_decoders Number of color images decoded concurrently. 0 uses all hardware threads. */
+  OpenCLPacketPipeline(const int deviceId = -1, const int color_decoders = 1);
   virtual ~OpenCLPacketPipeline();
 };
 #endif // LIBFREENECT2_WITH_OPENCL_SUPPORT
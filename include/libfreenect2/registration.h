@@ -71,13 +71,16 @@ public:
   void apply(int dx, int dy, float dz, float& cx, float &cy) const;
 
   /** Map color images onto depth images
-   * @param rgb Color image (1920x1080 BGRX)
+   * The registration is constructed with the full size color parameters, a
+   * downscaled color image uses the pixel covering the full size pixel. Depth
+   * pixels outside of a cropped color image get no color.
+   * @param rgb Color image (1920x1080 BGRX, or 960x540, 480x270 or 240x135 if downscaled, or a part of it placed by Frame::x_offset and Frame::y_offset if cropped)
    * @param depth Depth image (512x424 float)
    * @param[out] undistorted Undistorted depth image
    * @param[out] registered Color image for the depth image (512x424)
    * @param enable_filter Filter out pixels not visible to both cameras.
-   * @param[out] bigdepth If not `NULL`, return mapping of depth onto colors (1920x1082 float). **1082** not 1080, with a blank top and bottom row.
-   * @param[out] color_depth_map Index of mapped color pixel for each depth pixel (512x424).
+   * @param[out] bigdepth If not `NULL`, return mapping of depth onto colors (1920x1082 float, or the width of \a rgb by its height + 2). **1082** not 1080, with a blank top and bottom row.
+   * @param[out] color_depth_map Index of mapped color pixel of \a rgb for each depth pixel (512x424).
    */
   void apply(const Frame* rgb, const Frame* depth, Frame* undistorted, Frame* registered, const bool enable_filter = true, Frame* bigdepth = 0, int* color_depth_map = 0) const;
 
@@ -0,0 +1,131 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file buffer_ring.cpp Ring of packet buffers. */
+
+#include <libfreenect2/buffer_ring.h>
+
+namespace libfreenect2
+{
+
+BufferRing::BufferRing() :
+    front_buffer_index_(0),
+    buffer_data_(0)
+{
+}
+
+BufferRing::~BufferRing()
+{
+  delete[] buffer_data_;
+}
+
+/**
+ * Allocate \a count buffers of capacity \a buffer_size, the first one becomes
+ * the front buffer. No buffer may be handed over at this point.
+ * @param buffer_size Capacity of each buffer.
+ * @param count Number of buffers, at least 2.
+ */
+void BufferRing::allocate(size_t buffer_size, size_t count)
+{
+  if(count < 2)
+    count = 2;
+
+  delete[] buffer_data_;
+  buffer_data_ = new unsigned char[count * buffer_size];
+
+  buffer_.resize(count);
+  in_use_.assign(count, false);
+
+  for(size_t i = 0; i < count; ++i)
+  {
+    buffer_[i].capacity = buffer_size;
+    buffer_[i].length = 0;
+    buffer_[i].data = buffer_data_ + i * buffer_size;
+    buffer_[i].ring = this;
+  }
+
+  front_buffer_index_ = 0;
+  in_use_[0] = true;
+}
+
+/**
+ * Get the number of buffers.
+ * @return Number of buffers.
+ */
+size_t BufferRing::size() const
+{
+  return buffer_.size();
+}
+
+/**
+ * Get front buffer.
+ * @return The front buffer.
+ */
+Buffer& BufferRing::front()
+{
+  return buffer_[front_buffer_index_];
+}
+
+/**
+ * Hand the front buffer over and make the next free buffer the front buffer.
+ * @return False if no buffer is free, the front buffer is then kept and must not be handed over.
+ */
+bool BufferRing::next()
+{
+  libfreenect2::lock_guard l(mutex_);
+
+  const size_t count = buffer_.size();
+
+  for(size_t i = 1; i < count; ++i)
+  {
+    size_t index = (front_buffer_index_ + i) % count;
+
+    if(!in_use_[index])
+    {
+      in_use_[index] = true;
+      front_buffer_index_ = index;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Return a handed over buffer to its ring.
+ * @param buffer Buffer to release, may be 0 or not belong to a ring.
+ */
+void BufferRing::release(Buffer *buffer)
+{
+  if(buffer == 0 || buffer->ring == 0)
+    return;
+
+  BufferRing &ring = *buffer->ring;
+  libfreenect2::lock_guard l(ring.mutex_);
+  ring.in_use_[buffer - &ring.buffer_[0]] = false;
+}
+
+} /* namespace libfreenect2 */
@@ -30,8 +30,26 @@
 #include <libfreenect2/resource.h>
 #include <libfreenect2/protocol/response.h>
 #include <libfreenect2/logging.h>
+#include <libfreenect2/threading.h>
 
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
 
 #include <limits>
 
@@ -41,6 +59,24 @@
 #include <cmath>
 #include <limits>
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && !defined(__clang__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || \
+     (defined(__clang__) && (__clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8))))
+#define LIBFREENECT2_CPU_DEPTH_AVX2
+#define LIBFREENECT2_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define LIBFREENECT2_CPU_DEPTH_AVX2
+#define LIBFREENECT2_AVX2_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LIBFREENECT2_CPU_DEPTH_NEON
+#include <arm_neon.h>
+#endif
+
 /**
  * Vector class.
  * @tparam ScalarT Type of the elements.
@@ -107,7 +143,7 @@ private:
 
 public:
   /** Default constructor. */
-  Mat():buffer_(0), buffer_end_(0)
+  Mat():owns_buffer(false), buffer_(0), buffer_end_(0)
   {
   }
 
@@ -169,6 +205,19 @@ public:
     allocate(width, height);
   }
 
+  /**
+   * Use an external buffer as new image buffer.
+   * @param height Height of the new image.
+   * @param width Width of the new image.
+   * @param external_buffer Provided buffer of at least \a height * \a width elements.
+   */
+  template<typename DataT>
+  void create(int height, int width, DataT *external_buffer)
+  {
+    deallocate();
+    allocate(width, height, reinterpret_cast<unsigned char *>(external_buffer));
+  }
+
   /**
    * Copy image data to the provided matrix.
    * @param other Destination to copy to.
@@ -230,6 +279,80 @@ public:
   }
 };
 
+/**
+ * Planar image, storing every component of a pixel in its own matrix.
+ * @tparam ScalarT Element type of the planes.
+ * @tparam Size Number of planes.
+ */
+template<typename ScalarT, int Size>
+struct Planes
+{
+  Mat<ScalarT> plane[Size];
+
+  /**
+   * Construct new buffers for all planes.
+   * @param height Height of the new image.
+   * @param width Width of the new image.
+   */
+  void create(int height, int width)
+  {
+    for(int i = 0; i < Size; ++i)
+      plane[i].create(height, width);
+  }
+
+  /**
+   * Use an external buffer for all planes.
+   * @param height Height of the new image.
+   * @param width Width of the new image.
+   * @param external_buffer Provided buffer of at least sizeInBytes() bytes.
+   */
+  void create(int height, int width, unsigned char *external_buffer)
+  {
+    for(int i = 0; i < Size; ++i)
+      plane[i].create(height, width, external_buffer + i * height * width * sizeof(ScalarT));
+  }
+
+  /**
+   * Get the size of a buffer for all planes.
+   * @param height Height of the image.
+   * @param width Width of the image.
+   * @return Number of bytes.
+   */
+  static size_t sizeInBytes(int height, int width)
+  {
+    return Size * height * width * sizeof(ScalarT);
+  }
+};
+
+/**
+ * Get row \a y of a rolling row buffer, which keeps the last height() rows of a larger image.
+ * @param m Row buffer.
+ * @param y Row in the image.
+ * @return Start of the row.
+ */
+template<typename ScalarT>
+ScalarT *windowRow(Mat<ScalarT> &m, int y)
+{
+  return m.ptr(y % m.height(), 0);
+}
+
+/**
+ * Round and clamp the columns [x_begin, x_end) of a row to Frame::UInt16.
+ * Non-positive values and NaN become 0.
+ * @param in Row of 512 values.
+ * @param [out] out Converted row.
+ * @param x_begin First column.
+ * @param x_end End of the columns.
+ */
+static void convertRowToUInt16(const float *in, uint16_t *out, int x_begin, int x_end)
+{
+  for(int x = x_begin; x < x_end; ++x)
+  {
+    float v = in[x];
+    out[x] = v > 0.0f ? uint16_t(std::min(v, 65535.0f) + 0.5f) : 0;
+  }
+}
+
 /**
  * Copy and flip buffer upside-down (upper part to bottom, bottom part to top).
  * @tparam ScalarT Type of the element of the buffer.
@@ -261,577 +384,2406 @@ void flipHorizontal(const Mat<ScalarT> &in, Mat<ScalarT>& out)
 namespace libfreenect2
 {
 
-inline int bfi(int width, int offset, int src2, int src3)
-{
-  int bitmask = (((1 << width)-1) << offset) & 0xffffffff;
-  return ((src2 << offset) & bitmask) | (src3 & ~bitmask);
-}
+/*
+Each row of a sub image is 352 16-bit words holding 512 packed 11-bit samples.
+Sample j is the measurement of column x = 4 * (j % 128) + j / 128, i.e. the
+shader code computes the bit offset of x as 11 * ((x >> 2) + bfi(2, 7, x, 0)).
 
-class CpuDepthPacketProcessorImpl: public WithPerfLogging
+The row decoders below unpack all 512 samples of a row and map them through
+the 11 to 16 bit lookup table. The output is in sample order; the decode
+table of the processor maps each column to its sample.
+*/
+
+/** Decode one row of a sub image to LUT mapped samples. */
+typedef void (*DecodeRowFunction)(const uint16_t *row, const int16_t *lut, int16_t *out);
+
+/**
+ * Size of a decoded row. Sample 512 holds the LUT value of 0, which is read by
+ * the columns without a measurement.
+ */
+static const int DECODED_ROW_SIZE = 512 + 8;
+static const int INVALID_SAMPLE = 512;
+
+/**
+ * Decode samples [begin, 512) of a row one by one.
+ * The second word is only read if the sample crosses a word boundary, so the
+ * last sample does not read past the end of the row.
+ */
+static void decodeRowScalarFrom(const uint16_t *row, const int16_t *lut, int16_t *out, int begin)
 {
-public:
-  Mat<uint16_t> p0_table0, p0_table1, p0_table2;
-  Mat<float> x_table, z_table;
+  for(int j = begin; j < 512; ++j)
+  {
+    int bit = j * 11;
+    int word = bit >> 4;
+    int shift = bit & 15;
 
-  int16_t lut11to16[2048];
+    uint32_t v = row[word] >> shift;
+    if(shift > 5)
+    {
+      v |= uint32_t(row[word + 1]) << (16 - shift);
+    }
 
-  float trig_table0[512*424][6];
-  float trig_table1[512*424][6];
-  float trig_table2[512*424][6];
+    out[j] = lut[v & 2047];
+  }
+}
 
-  bool enable_bilateral_filter, enable_edge_filter;
-  DepthPacketProcessor::Parameters params;
+static void decodeRowScalar(const uint16_t *row, const int16_t *lut, int16_t *out)
+{
+  decodeRowScalarFrom(row, lut, out, 0);
+}
 
-  Frame *ir_frame, *depth_frame;
+/*
+The SIMD decoders work on groups of eight samples, which occupy exactly
+11 bytes. Sample k of a group starts at byte (11 * k) / 8 with a bit shift of
+(11 * k) % 8, so a byte shuffle moves the 4 bytes containing each sample into
+its own 32-bit lane and a variable shift plus mask extracts the value.
+
+A group reads 16 bytes, so the last group of a row (bytes 693 to 703) is
+decoded by the scalar code to stay within the row.
+*/
+static const int DECODE_SIMD_GROUPS = 63;
+
+#ifdef LIBFREENECT2_CPU_DEPTH_AVX2
+/** The LUT has to be padded by one entry, because the gather reads 32 bits. */
+LIBFREENECT2_AVX2_TARGET static void decodeRowAvx2(const uint16_t *row, const int16_t *lut, int16_t *out)
+{
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(row);
 
-  bool flip_ptables;
+  const __m256i shuffle = _mm256_setr_epi8(
+      0, 1, 2, 3,  1, 2, 3, 4,  2, 3, 4, 5,  4, 5, 6, 7,
+      5, 6, 7, 8,  6, 7, 8, 9,  8, 9, 10, 11,  9, 10, 11, 12);
+  const __m256i shifts = _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5);
+  const __m256i mask = _mm256_set1_epi32(2047);
+  const int *lut32 = reinterpret_cast<const int *>(lut);
 
-  CpuDepthPacketProcessorImpl()
+  for(int g = 0; g < DECODE_SIMD_GROUPS; ++g)
   {
-    newIrFrame();
-    newDepthFrame();
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + 11 * g));
+    __m256i v = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(in), shuffle);
+    v = _mm256_and_si256(_mm256_srlv_epi32(v, shifts), mask);
 
-    enable_bilateral_filter = true;
-    enable_edge_filter = true;
+    // gather 32 bits at lut + 2 * v and sign extend the lower half
+    __m256i r = _mm256_i32gather_epi32(lut32, v, 2);
+    r = _mm256_srai_epi32(_mm256_slli_epi32(r, 16), 16);
 
-    flip_ptables = true;
+    // pack to 16 bit, the packing works per 128 bit lane
+    r = _mm256_permute4x64_epi64(_mm256_packs_epi32(r, r), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 8 * g), _mm256_castsi256_si128(r));
   }
 
-  /** Allocate a new IR frame. */
-  void newIrFrame()
-  {
-    ir_frame = new Frame(512, 424, 4);
-    //ir_frame = new Frame(512, 424, 12);
-  }
+  decodeRowScalarFrom(row, lut, out, 8 * DECODE_SIMD_GROUPS);
+}
 
-  ~CpuDepthPacketProcessorImpl()
-  {
-    delete ir_frame;
-    delete depth_frame;
-  }
+static bool cpuSupportsAvx2()
+{
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if(info[0] < 7) return false;
+
+  // AVX and OSXSAVE, and the OS saves the YMM registers
+  __cpuid(info, 1);
+  if((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+  if((_xgetbv(0) & 6) != 6) return false;
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // LIBFREENECT2_CPU_DEPTH_AVX2
 
-  /** Allocate a new depth frame. */
-  void newDepthFrame()
-  {
-    depth_frame = new Frame(512, 424, 4);
-  }
+#ifdef LIBFREENECT2_CPU_DEPTH_NEON
+/** NEON has no gather, so the LUT is applied per sample. */
+static void decodeRowNeon(const uint16_t *row, const int16_t *lut, int16_t *out)
+{
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(row);
+
+  static const uint8_t shuffle[32] = {
+      0, 1, 2, 3,  1, 2, 3, 4,  2, 3, 4, 5,  4, 5, 6, 7,
+      5, 6, 7, 8,  6, 7, 8, 9,  8, 9, 10, 11,  9, 10, 11, 12};
+  static const int32_t shifts[8] = {0, -3, -6, -1, -4, -7, -2, -5};
+
+  const uint8x8_t shuffle0 = vld1_u8(shuffle + 0), shuffle1 = vld1_u8(shuffle + 8);
+  const uint8x8_t shuffle2 = vld1_u8(shuffle + 16), shuffle3 = vld1_u8(shuffle + 24);
+  const int32x4_t shifts_lo = vld1q_s32(shifts), shifts_hi = vld1q_s32(shifts + 4);
+  const uint32x4_t mask = vdupq_n_u32(2047);
+
+  uint32_t idx[8];
 
-  int32_t decodePixelMeasurement(unsigned char* data, int sub, int x, int y)
+  for(int g = 0; g < DECODE_SIMD_GROUPS; ++g)
   {
-    // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
-    uint16_t *ptr = reinterpret_cast<uint16_t *>(data + 298496 * sub);
-    int i = y < 212 ? y + 212 : 423 - y;
-    ptr += 352*i;
+    uint8x8x2_t in;
+    in.val[0] = vld1_u8(bytes + 11 * g);
+    in.val[1] = vld1_u8(bytes + 11 * g + 8);
 
-    /**
-     r1.yz = r2.xxyx < l(0, 1, 0, 0) // ilt
-     r1.y = r1.z | r1.y // or
-     */
-    bool r1y = x < 1 || y < 0;
-    /*
-    r1.zw = l(0, 0, 510, 423) < r2.xxxy // ilt
-    r1.z = r1.w | r1.z // or
-    */
-    bool r1z = 510 < x || 423 < y;
-    /*
-    r1.y = r1.z | r1.y // or
-    */
-    r1y = r1y || r1z;
-    /*
-    r1.y = r1.y & l(0x1fffffff) // and
-    */
-    int r1yi = r1y ? 0xffffffff : 0x0;
-    r1yi &= 0x1fffffff;
-
-    /*
-    bfi r1.z, l(2), l(7), r2.x, l(0)
-    ushr r1.w, r2.x, l(2)
-    r1.z = r1.w + r1.z // iadd
-    */
-    int r1zi = bfi(2, 7, x, 0);
-    int r1wi = x >> 2;
-    r1zi = r1wi + r1zi;
-
-    /*
-    imul null, r1.z, r1.z, l(11)
-    ushr r1.w, r1.z, l(4)
-    r1.y = r1.w + r1.y // iadd
-    r1.w = r1.y + l(1) // iadd
-    r1.z = r1.z & l(15) // and
-    r4.w = -r1.z + l(16) // iadd
-     */
-    r1zi = (r1zi * 11L) & 0xffffffff;
-    r1wi = r1zi >> 4;
-    r1yi = r1yi + r1wi;
-    r1zi = r1zi & 15;
-    int r4wi = -r1zi + 16;
+    uint32x4_t lo = vreinterpretq_u32_u8(vcombine_u8(vtbl2_u8(in, shuffle0), vtbl2_u8(in, shuffle1)));
+    uint32x4_t hi = vreinterpretq_u32_u8(vcombine_u8(vtbl2_u8(in, shuffle2), vtbl2_u8(in, shuffle3)));
+
+    vst1q_u32(idx + 0, vandq_u32(vshlq_u32(lo, shifts_lo), mask));
+    vst1q_u32(idx + 4, vandq_u32(vshlq_u32(hi, shifts_hi), mask));
 
-    if(r1yi > 352)
+    int16_t *o = out + 8 * g;
+    for(int k = 0; k < 8; ++k)
     {
-      return lut11to16[0];
+      o[k] = lut[idx[k]];
     }
-
-    int i1 = ptr[r1yi];
-    int i2 = ptr[r1yi + 1];
-    i1 = i1 >> r1zi;
-    i2 = i2 << r4wi;
-
-    return lut11to16[((i1 | i2) & 2047)];
   }
 
-  /**
-   * Initialize cos and sin trigonometry tables for each of the three #phase_in_rad parameters.
-   * @param p0table Angle at every (x, y) position.
-   * @param [out] trig_tables (3 cos tables, followed by 3 sin tables for the three phases.
-   */
-  void fillTrigTable(Mat<uint16_t> &p0table, float trig_table[512*424][6])
-  {
-    int i = 0;
+  decodeRowScalarFrom(row, lut, out, 8 * DECODE_SIMD_GROUPS);
+}
+#endif // LIBFREENECT2_CPU_DEPTH_NEON
 
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, ++i)
-      {
-        float p0 = -((float)p0table.at(y, x)) * 0.000031 * M_PI;
+/*
+Polynomial approximations of the transcendental functions, used if
+Config::EnableFastMath is set. They are branch free, so they inline into the
+pixel loops and can be vectorized. The coefficients are those of the Cephes
+single precision library. Maximum errors measured against double precision:
+
+- fastAtan2: 2.8e-7 rad absolute. atan2(0, 0) returns 0.
+- fastExp: 1 ulp for x in [-87, 88]. Smaller x return 0, larger x saturate
+  at exp(88) instead of overflowing to infinity.
+- fastLog: 1 ulp for positive normal x. 0 returns -infinity, negative x NaN.
+*/
+
+inline float asFloat(uint32_t bits)
+{
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
 
-        float tmp0 = p0 + params.phase_in_rad[0];
-        float tmp1 = p0 + params.phase_in_rad[1];
-        float tmp2 = p0 + params.phase_in_rad[2];
+inline uint32_t asBits(float f)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
 
-        trig_table[i][0] = std::cos(tmp0);
-        trig_table[i][1] = std::cos(tmp1);
-        trig_table[i][2] = std::cos(tmp2);
+inline float fastAtan2(float y, float x)
+{
+  float ax = std::abs(x), ay = std::abs(y);
+  float max_a = std::max(ax, ay);
+  float a = 0.0f < max_a ? std::min(ax, ay) / max_a : 0.0f;
+
+  // reduce to [-tan(pi/8), tan(pi/8)] using atan(a) = pi/4 + atan((a - 1) / (a + 1))
+  bool reduce = a > 0.414213562f;
+  float t = reduce ? (a - 1.0f) / (a + 1.0f) : a;
+  float z = t * t;
+  float r = (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * t + t;
+
+  r = reduce ? r + 0.785398163f : r;
+  r = ay > ax ? 1.57079633f - r : r;
+  r = x < 0.0f ? 3.14159265f - r : r;
+  return y < 0.0f ? -r : r;
+}
 
-        trig_table[i][3] = std::sin(-tmp0);
-        trig_table[i][4] = std::sin(-tmp1);
-        trig_table[i][5] = std::sin(-tmp2);
-      }
-  }
+inline float fastExp(float x)
+{
+  float clamped = std::min(std::max(x, -87.0f), 88.0f);
 
-  /**
-   * Process measurement (all three layers).
-   * @param [in] trig_table Trigonometry tables.
-   * @param abMultiplierPerFrq Multiplier.
-   * @param x X position in the image.
-   * @param y Y position in the image.
-   * @param m Measurement.
-   * @param [out] m_out Processed measurement (IR a, IR b, IR amplitude).
-   */
-  void processMeasurementTriple(float trig_table[512*424][6], float abMultiplierPerFrq, int x, int y, const int32_t* m, float* m_out)
-  {
-    int offset = y * 512 + x;
-    float cos_tmp0 = trig_table[offset][0];
-    float cos_tmp1 = trig_table[offset][1];
-    float cos_tmp2 = trig_table[offset][2];
+  // exp(x) = 2^n * exp(f), with ln(2) split in two parts for precision
+  float n = std::floor(clamped * 1.44269504f + 0.5f);
+  float f = clamped - n * 0.693359375f + n * 2.12194440e-4f;
+  float z = f * f;
+  float p = (((((1.9875691500e-4f * f + 1.3981999507e-3f) * f + 8.3334519073e-3f) * f + 4.1665795894e-2f) * f + 1.6666665459e-1f) * f + 5.0000001201e-1f) * z + f + 1.0f;
 
-    float sin_negtmp0 = trig_table[offset][3];
-    float sin_negtmp1 = trig_table[offset][4];
-    float sin_negtmp2 = trig_table[offset][5];
+  p *= asFloat(uint32_t(int(n) + 127) << 23);
+  return x < -87.0f ? 0.0f : p;
+}
 
-    float zmultiplier = z_table.at(y, x);
-    bool cond0 = 0 < zmultiplier;
-    bool cond1 = (m[0] == 32767 || m[1] == 32767 || m[2] == 32767) && cond0;
+inline float fastLog(float x)
+{
+  // x = 2^e * m, with m in [sqrt(2) / 2, sqrt(2)]
+  uint32_t bits = asBits(x);
+  float e = float(int(bits >> 23) - 127);
+  float m = asFloat((bits & 0x007fffff) | 0x3f800000);
 
-    // formula given in Patent US 8,587,771 B2
-    float tmp3 = cos_tmp0 * m[0] + cos_tmp1 * m[1] + cos_tmp2 * m[2];
-    float tmp4 = sin_negtmp0 * m[0] + sin_negtmp1 * m[1] + sin_negtmp2 * m[2];
+  bool high = m > 1.41421356f;
+  m = high ? m * 0.5f : m;
+  e = high ? e + 1.0f : e;
 
-    // only if modeMask & 32 != 0;
-    if(true)//(modeMask & 32) != 0)
-    {
-        tmp3 *= abMultiplierPerFrq;
-        tmp4 *= abMultiplierPerFrq;
-    }
-    float tmp5 = std::sqrt(tmp3 * tmp3 + tmp4 * tmp4) * params.ab_multiplier;
+  float f = m - 1.0f;
+  float z = f * f;
+  float p = ((((((((7.0376836292e-2f * f - 1.1514610310e-1f) * f + 1.1676998740e-1f) * f - 1.2420140846e-1f) * f + 1.4249322787e-1f) * f - 1.6668057665e-1f) * f + 2.0000714765e-1f) * f - 2.4999993993e-1f) * f + 3.3333331174e-1f) * f * z;
+  float r = f + (p - 0.5f * z + e * -2.12194440e-4f) + e * 0.693359375f;
 
-    // invalid pixel because zmultiplier < 0 ??
-    tmp3 = cond0 ? tmp3 : 0;
-    tmp4 = cond0 ? tmp4 : 0;
-    tmp5 = cond0 ? tmp5 : 0;
+  return 0.0f < x ? r : (x == 0.0f ? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::quiet_NaN());
+}
 
-    // invalid pixel because saturated?
-    tmp3 = !cond1 ? tmp3 : 0;
-    tmp4 = !cond1 ? tmp4 : 0;
-    tmp5 = !cond1 ? tmp5 : 65535.0; // some kind of norm calculated from tmp3 and tmp4
+/**
+ * Transcendental functions of the depth pipeline.
+ * @tparam FastMath Use the polynomial approximations instead of the standard library.
+ */
+template<bool FastMath>
+struct DepthMath
+{
+  static float atan2(float y, float x) { return std::atan2(y, x); }
+  static float exp(float x) { return std::exp(x); }
+  static float log(float x) { return std::log(x); }
+};
 
-    m_out[0] = tmp3; // ir image a
-    m_out[1] = tmp4; // ir image b
-    m_out[2] = tmp5; // ir amplitude
-  }
+template<>
+struct DepthMath<true>
+{
+  static float atan2(float y, float x) { return fastAtan2(y, x); }
+  static float exp(float x) { return fastExp(x); }
+  static float log(float x) { return fastLog(x); }
+};
 
+/**
+ * Scratch memory of a processor, allocated once and reused for every frame.
+ * Buffers are carved out of one block, which is pre-faulted and can be backed
+ * by huge pages. Requests that do not fit are served from the heap and counted,
+ * so steady state processing can be checked to be allocation free.
+ */
+class ScratchArena
+{
+public:
   /**
-   * Transform measurement.
-   * @param [in, out] m Measurement.
+   * @param capacity Size of the block in bytes.
+   * @param huge_pages Try to back the block with huge pages.
    */
-  void transformMeasurements(float* m)
+  ScratchArena(size_t capacity, bool huge_pages) :
+    block_(0),
+    heap_block_(0),
+    mapped_size_(0),
+    capacity_(capacity),
+    used_(0),
+    heap_allocations_(0)
   {
-    float tmp0 = std::atan2((m[1]), (m[0]));
-    tmp0 = tmp0 < 0 ? tmp0 + M_PI * 2.0f : tmp0;
-    tmp0 = (tmp0 != tmp0) ? 0 : tmp0;
+    if(huge_pages)
+    {
+      allocateHugePages();
+    }
 
-    float tmp1 = std::sqrt(m[0] * m[0] + m[1] * m[1]) * params.ab_multiplier;
+    if(block_ == 0)
+    {
+      heap_block_ = new unsigned char[capacity_ + ALIGNMENT];
+      block_ = heap_block_ + (ALIGNMENT - reinterpret_cast<size_t>(heap_block_) % ALIGNMENT) % ALIGNMENT;
+    }
 
-    m[0] = tmp0; // phase
-    m[1] = tmp1; // ir amplitude - (possibly bilateral filtered)
+    // touch every page now instead of page faulting while processing
+    std::memset(block_, 0, capacity_);
   }
 
-  /**
-   * Process first pixel stage.
-   * @param x Horizontal position.
-   * @param y Vertical position.
-   * @param data
-   * @param [out] m0_out First layer output.
-   * @param [out] m1_out Second layer output.
-   * @param [out] m2_out Third layer output.
-   */
-  void processPixelStage1(int x, int y, unsigned char* data, float *m0_out, float *m1_out, float *m2_out)
+  ~ScratchArena()
   {
-    int32_t m0_raw[3], m1_raw[3], m2_raw[3];
+    for(size_t i = 0; i < overflow_blocks_.size(); ++i)
+    {
+      delete[] overflow_blocks_[i];
+    }
+
+    if(mapped_size_ != 0)
+    {
+#if defined(__linux__)
+      munmap(block_, mapped_size_);
+#elif defined(_WIN32)
+      VirtualFree(block_, 0, MEM_RELEASE);
+#endif
+    }
 
-    m0_raw[0] = decodePixelMeasurement(data, 0, x, y);
-    m0_raw[1] = decodePixelMeasurement(data, 1, x, y);
-    m0_raw[2] = decodePixelMeasurement(data, 2, x, y);
-    m1_raw[0] = decodePixelMeasurement(data, 3, x, y);
-    m1_raw[1] = decodePixelMeasurement(data, 4, x, y);
-    m1_raw[2] = decodePixelMeasurement(data, 5, x, y);
-    m2_raw[0] = decodePixelMeasurement(data, 6, x, y);
-    m2_raw[1] = decodePixelMeasurement(data, 7, x, y);
-    m2_raw[2] = decodePixelMeasurement(data, 8, x, y);
+    delete[] heap_block_;
+  }
 
-    processMeasurementTriple(trig_table0, params.ab_multiplier_per_frq[0], x, y, m0_raw, m0_out);
-    processMeasurementTriple(trig_table1, params.ab_multiplier_per_frq[1], x, y, m1_raw, m1_out);
-    processMeasurementTriple(trig_table2, params.ab_multiplier_per_frq[2], x, y, m2_raw, m2_out);
+  /** Size of a buffer of \a size bytes in the block, including alignment. */
+  static size_t alignedSize(size_t size)
+  {
+    return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
   }
 
   /**
-   * Filter pixels in stage 1.
-   * @param x Horizontal position.
-   * @param y Vertical position.
-   * @param m Input data?
-   * @param [out] Output data.
-   * @param [out] bilateral_max_edge_test Whether the accumulated distance of each image stayed within limits.
+   * Get an aligned buffer of \a size bytes, which stays valid for the lifetime of the arena.
+   * Falls back to the heap if the block is exhausted.
    */
-  void filterPixelStage1(int x, int y, const Mat<Vec<float, 9> >& m, float* m_out, bool& bilateral_max_edge_test)
+  unsigned char *allocate(size_t size)
   {
-    const float *m_ptr = (m.ptr(y, x)->val);
-    bilateral_max_edge_test = true;
+    size = alignedSize(size);
 
-    if(x < 1 || y < 1 || x > 510 || y > 422)
+    if(used_ + size <= capacity_)
     {
-      for(int i = 0; i < 9; ++i)
-        m_out[i] = m_ptr[i];
+      unsigned char *buffer = block_ + used_;
+      used_ += size;
+      return buffer;
     }
-    else
-    {
-      float m_normalized[2];
-      float other_m_normalized[2];
 
-      int offset = 0;
+    heap_allocations_++;
+    overflow_blocks_.push_back(new unsigned char[size]);
+    return overflow_blocks_.back();
+  }
 
-      for(int i = 0; i < 3; ++i, m_ptr += 3, m_out += 3, offset += 3)
-      {
-        float norm2 = m_ptr[0] * m_ptr[0] + m_ptr[1] * m_ptr[1];
-        float inv_norm = 1.0f / std::sqrt(norm2);
-        inv_norm = (inv_norm == inv_norm) ? inv_norm : std::numeric_limits<float>::infinity();
+  /** Number of allocate() calls served from the heap. */
+  size_t heapAllocations() const
+  {
+    return heap_allocations_;
+  }
 
-        m_normalized[0] = m_ptr[0] * inv_norm;
-        m_normalized[1] = m_ptr[1] * inv_norm;
+private:
+  static const size_t ALIGNMENT = 64;
 
-        int j = 0;
+  unsigned char *block_;
+  unsigned char *heap_block_; ///< Backing memory of #block_ if it was not mapped.
+  size_t mapped_size_; ///< Size of the huge page mapping backing #block_, 0 if there is none.
+  size_t capacity_;
+  size_t used_;
+  size_t heap_allocations_;
+  std::vector<unsigned char *> overflow_blocks_;
 
-        float weight_acc = 0.0f;
-        float weighted_m_acc[2] = {0.0f, 0.0f};
+  void allocateHugePages()
+  {
+#if defined(__linux__)
+    const size_t huge_page_size = 2 * 1024 * 1024;
+    size_t size = (capacity_ + huge_page_size - 1) / huge_page_size * huge_page_size;
+    void *block = MAP_FAILED;
 
-        float threshold = (params.joint_bilateral_ab_threshold * params.joint_bilateral_ab_threshold) / (params.ab_multiplier * params.ab_multiplier);
-        float joint_bilateral_exp = params.joint_bilateral_exp;
+#ifdef MAP_HUGETLB
+    block = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if(block == MAP_FAILED)
+    {
+      // no reserved huge pages, ask for transparent huge pages instead
+      block = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(block == MAP_FAILED)
+      {
+        LOG_WARNING << "failed to map scratch memory";
+        return;
+      }
+#ifdef MADV_HUGEPAGE
+      madvise(block, size, MADV_HUGEPAGE);
+#endif
+    }
 
-        if(norm2 < threshold)
-        {
-          threshold = 0.0f;
-          joint_bilateral_exp = 0.0f;
-        }
+    block_ = static_cast<unsigned char *>(block);
+    mapped_size_ = size;
+#elif defined(_WIN32)
+    size_t huge_page_size = GetLargePageMinimum();
+    if(huge_page_size == 0)
+    {
+      LOG_WARNING << "large pages are not supported";
+      return;
+    }
 
-        float dist_acc = 0.0f;
+    size_t size = (capacity_ + huge_page_size - 1) / huge_page_size * huge_page_size;
+    // requires the SeLockMemoryPrivilege
+    void *block = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if(block == 0)
+    {
+      LOG_WARNING << "failed to allocate large pages";
+      return;
+    }
 
-        for(int yi = -1; yi < 2; ++yi)
-        {
-          for(int xi = -1; xi < 2; ++xi, ++j)
-          {
-            if(yi == 0 && xi == 0)
-            {
-              weight_acc += params.gaussian_kernel[j];
+    block_ = static_cast<unsigned char *>(block);
+    mapped_size_ = size;
+#else
+    LOG_WARNING << "huge pages are not supported on this platform";
+#endif
+  }
+};
 
-              weighted_m_acc[0] += params.gaussian_kernel[j] * m_ptr[0];
-              weighted_m_acc[1] += params.gaussian_kernel[j] * m_ptr[1];
-              continue;
-            }
+/**
+ * Pool of worker threads executing a function on horizontal bands of an image.
+ * The thread calling run() works on bands as well, so a pool of n threads only starts n - 1 threads.
+ */
+class BandWorkerPool
+{
+public:
+  /** Function processing the rows [y_begin, y_end) of band number \a band. */
+  typedef void (*BandFunction)(void *context, int band, int y_begin, int y_end);
+
+  BandWorkerPool(int num_threads) :
+    shutdown_(false),
+    generation_(0),
+    function_(0),
+    context_(0),
+    height_(0),
+    band_height_(0),
+    num_bands_(0),
+    next_band_(0),
+    finished_bands_(0)
+  {
+    for(int i = 1; i < num_threads; ++i)
+    {
+      threads_.push_back(new libfreenect2::thread(&BandWorkerPool::static_execute, this));
+    }
+  }
 
-            const float *other_m_ptr = (m.ptr(y + yi, x + xi)->val) + offset;
-            float other_norm2 = other_m_ptr[0] * other_m_ptr[0] + other_m_ptr[1] * other_m_ptr[1];
-            // TODO: maybe fix numeric problems when norm = 0 - original code uses reciprocal square root, which returns +inf for +0
-            float other_inv_norm = 1.0f / std::sqrt(other_norm2);
-            other_inv_norm = (other_inv_norm == other_inv_norm) ? other_inv_norm : std::numeric_limits<float>::infinity();
+  ~BandWorkerPool()
+  {
+    {
+      libfreenect2::lock_guard l(mutex_);
+      shutdown_ = true;
+    }
+    work_condition_.notify_all();
 
-            other_m_normalized[0] = other_m_ptr[0] * other_inv_norm;
-            other_m_normalized[1] = other_m_ptr[1] * other_inv_norm;
+    for(size_t i = 0; i < threads_.size(); ++i)
+    {
+      threads_[i]->join();
+      delete threads_[i];
+    }
+  }
 
-            float dist = -(other_m_normalized[0] * m_normalized[0] + other_m_normalized[1] * m_normalized[1]);
-            dist += 1.0f;
-            dist *= 0.5f;
+  int numThreads() const
+  {
+    return threads_.size() + 1;
+  }
 
-            float weight = 0.0f;
+  /**
+   * Split the rows [0, height) into one band per thread and execute \a function on all of them.
+   * Returns once every band has been processed.
+   */
+  void run(BandFunction function, void *context, int height)
+  {
+    {
+      libfreenect2::lock_guard l(mutex_);
+      function_ = function;
+      context_ = context;
+      height_ = height;
+      num_bands_ = numThreads();
+      band_height_ = (height + num_bands_ - 1) / num_bands_;
+      next_band_ = 0;
+      finished_bands_ = 0;
+      generation_++;
+    }
+    work_condition_.notify_all();
 
-            if(other_norm2 >= threshold)
-            {
-              weight = (params.gaussian_kernel[j] * std::exp(-1.442695f * joint_bilateral_exp * dist));
-              dist_acc += dist;
-            }
+    executeBands();
 
-            weighted_m_acc[0] += weight * other_m_ptr[0];
-            weighted_m_acc[1] += weight * other_m_ptr[1];
+    libfreenect2::unique_lock l(mutex_);
 
-            weight_acc += weight;
+    while(finished_bands_ < num_bands_)
+    {
+      WAIT_CONDITION(done_condition_, mutex_, l)
+    }
+  }
+
+private:
+  bool shutdown_;
+  unsigned int generation_; ///< Incremented by every run(), wakes up the workers.
+
+  BandFunction function_;
+  void *context_;
+  int height_;
+  int band_height_;
+  int num_bands_;
+  int next_band_;      ///< Next band not yet taken by a thread.
+  int finished_bands_;
+
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable work_condition_;
+  libfreenect2::condition_variable done_condition_;
+  std::vector<libfreenect2::thread *> threads_;
+
+  static void static_execute(void *data)
+  {
+    static_cast<BandWorkerPool *>(data)->execute();
+  }
+
+  void execute()
+  {
+    unsigned int seen_generation = 0;
+
+    for(;;)
+    {
+      {
+        libfreenect2::unique_lock l(mutex_);
+
+        while(!shutdown_ && generation_ == seen_generation)
+        {
+          WAIT_CONDITION(work_condition_, mutex_, l)
+        }
+
+        if(shutdown_) return;
+
+        seen_generation = generation_;
+      }
+
+      executeBands();
+    }
+  }
+
+  /** Take bands of the current run until none are left. */
+  void executeBands()
+  {
+    for(;;)
+    {
+      BandFunction function;
+      void *context;
+      int band, y_begin, y_end;
+
+      {
+        libfreenect2::lock_guard l(mutex_);
+
+        if(next_band_ >= num_bands_) return;
+
+        function = function_;
+        context = context_;
+        band = next_band_;
+        y_begin = band * band_height_;
+        y_end = std::min(height_, y_begin + band_height_);
+        next_band_++;
+      }
+
+      if(y_begin < y_end)
+      {
+        function(context, band, y_begin, y_end);
+      }
+
+      bool done;
+      {
+        libfreenect2::lock_guard l(mutex_);
+        finished_bands_++;
+        done = finished_bands_ == num_bands_;
+      }
+
+      if(done)
+      {
+        done_condition_.notify_all();
+      }
+    }
+  }
+};
+
+/**
+ * Runs consecutive frames through a fixed sequence of stages, so that
+ * different stages of different frames execute concurrently.
+ *
+ * Every frame in flight occupies one of a fixed number of slots, which are
+ * taken in round robin order. Stage 0 runs on the thread calling
+ * acquireSlot() and submitSlot(), every later stage on its own thread. Each
+ * stage handles the slots in the same round robin order, so frames leave the
+ * pipeline in the order they were submitted. A slot is handed from one stage
+ * to the next like an entry of a bounded queue: at most one frame per slot is
+ * in flight, and acquireSlot() blocks until the oldest frame has left.
+ */
+class StagePipeline
+{
+public:
+  /** Function executing stage \a stage (1 or later) of the frame in slot \a slot. */
+  typedef void (*StageFunction)(void *context, int stage, int slot);
+
+  StagePipeline(int num_stages, int num_slots, StageFunction function, void *context) :
+    shutdown_(false),
+    num_stages_(num_stages),
+    function_(function),
+    context_(context),
+    next_slot_(0),
+    slot_stage_(num_slots, 0)
+  {
+    stage_threads_.resize(num_stages);
+
+    for(int stage = 1; stage < num_stages; ++stage)
+    {
+      stage_threads_[stage].pipeline = this;
+      stage_threads_[stage].stage = stage;
+      threads_.push_back(new libfreenect2::thread(&StagePipeline::static_execute, &stage_threads_[stage]));
+    }
+  }
+
+  /** Waits for the frames in flight. */
+  ~StagePipeline()
+  {
+    flush();
+
+    {
+      libfreenect2::lock_guard l(mutex_);
+      shutdown_ = true;
+    }
+    condition_.notify_all();
+
+    for(size_t i = 0; i < threads_.size(); ++i)
+    {
+      threads_[i]->join();
+      delete threads_[i];
+    }
+  }
+
+  int numStages() const
+  {
+    return num_stages_;
+  }
+
+  /**
+   * Wait until the next slot is free.
+   * @return Slot for stage 0 of the next frame, to be passed on with submitSlot().
+   */
+  int acquireSlot()
+  {
+    libfreenect2::unique_lock l(mutex_);
+
+    while(slot_stage_[next_slot_] != 0)
+    {
+      WAIT_CONDITION(condition_, mutex_, l)
+    }
+
+    return next_slot_;
+  }
+
+  /** Hand \a slot to stage 1 after the caller has executed stage 0. */
+  void submitSlot(int slot)
+  {
+    {
+      libfreenect2::lock_guard l(mutex_);
+      slot_stage_[slot] = 1;
+      next_slot_ = (slot + 1) % slot_stage_.size();
+    }
+    condition_.notify_all();
+  }
+
+  /** Wait until all submitted frames have left the pipeline. */
+  void flush()
+  {
+    libfreenect2::unique_lock l(mutex_);
+
+    while(std::count(slot_stage_.begin(), slot_stage_.end(), 0) != int(slot_stage_.size()))
+    {
+      WAIT_CONDITION(condition_, mutex_, l)
+    }
+  }
+
+private:
+  struct StageThread
+  {
+    StagePipeline *pipeline;
+    int stage;
+  };
+
+  bool shutdown_;
+  int num_stages_;
+  StageFunction function_;
+  void *context_;
+  int next_slot_; ///< Slot of the next frame entering stage 0.
+  std::vector<int> slot_stage_; ///< Stage waiting for each slot, 0 if the slot is free.
+
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable condition_;
+  std::vector<StageThread> stage_threads_;
+  std::vector<libfreenect2::thread *> threads_;
+
+  static void static_execute(void *data)
+  {
+    StageThread *t = static_cast<StageThread *>(data);
+    t->pipeline->execute(t->stage);
+  }
+
+  void execute(int stage)
+  {
+    const int next_stage = stage + 1 < num_stages_ ? stage + 1 : 0;
+
+    for(int slot = 0;; slot = (slot + 1) % slot_stage_.size())
+    {
+      {
+        libfreenect2::unique_lock l(mutex_);
+
+        while(!shutdown_ && slot_stage_[slot] != stage)
+        {
+          WAIT_CONDITION(condition_, mutex_, l)
+        }
+
+        if(shutdown_) return;
+      }
+
+      function_(context_, stage, slot);
+
+      {
+        libfreenect2::lock_guard l(mutex_);
+        slot_stage_[slot] = next_stage;
+      }
+      condition_.notify_all();
+    }
+  }
+};
+
+/**
+ * cos and sin of the P0 phase of every pixel for the three frequencies.
+ * The phase shifts of the three measurements of a frequency are applied with
+ * cos(p + d) = cos(p) cos(d) - sin(p) sin(d), so the table only stores the
+ * unshifted phase: 5.2 MB instead of 15.6 MB for all nine shifted phases.
+ *
+ * Filled tables are immutable. Processors loading the same P0 tables share
+ * one table, see share() and release().
+ */
+struct TrigTable
+{
+  float cos_sin[512 * 424][3][2]; ///< cos and sin of the phase, by pixel and frequency.
+
+  /**
+   * Replace \a table by an identical table already in use, or register it.
+   * @param table Newly filled table, deleted if an identical one exists.
+   * @return Shared table, to be returned with release().
+   */
+  static TrigTable *share(TrigTable *table)
+  {
+    libfreenect2::lock_guard l(mutex_);
+
+    for(size_t i = 0; i < tables_.size(); ++i)
+    {
+      if(std::memcmp(tables_[i].table->cos_sin, table->cos_sin, sizeof(table->cos_sin)) == 0)
+      {
+        delete table;
+        tables_[i].references++;
+        LOG_INFO << "sharing trigonometry table with " << tables_[i].references - 1 << " other processor(s)";
+        return tables_[i].table;
+      }
+    }
+
+    Entry entry = { table, 1 };
+    tables_.push_back(entry);
+    return table;
+  }
+
+  /** Drop a reference to a table returned by share(). */
+  static void release(TrigTable *table)
+  {
+    libfreenect2::lock_guard l(mutex_);
+
+    for(size_t i = 0; i < tables_.size(); ++i)
+    {
+      if(tables_[i].table == table && --tables_[i].references == 0)
+      {
+        delete table;
+        tables_.erase(tables_.begin() + i);
+        return;
+      }
+    }
+  }
+
+private:
+  struct Entry
+  {
+    TrigTable *table;
+    int references;
+  };
+
+  static libfreenect2::mutex mutex_;
+  static std::vector<Entry> tables_;
+};
+
+libfreenect2::mutex TrigTable::mutex_;
+std::vector<TrigTable::Entry> TrigTable::tables_;
+
+class CpuDepthPacketProcessorImpl: public WithPerfLogging
+{
+public:
+  Mat<float> x_table, z_table;
+  Mat<float> binned_x_table, binned_z_table; ///< Tables of the binned pixels, see DepthPacketProcessor::binXZTables().
+  Mat<float> temporal_depth; ///< Per-pixel state of the temporal filter in processing order, 0 if invalid.
+  const Mat<float> *stage2_x_table, *stage2_z_table; ///< Tables of the pixels of stage 2 and the filters.
+
+  int16_t lut11to16[2048 + 1]; ///< Padded for 32-bit gathers.
+  DecodeRowFunction decode_row;
+
+  uint32_t sub_image_words; ///< Number of 16-bit words per sub image.
+  uint32_t row_offset[424]; ///< Word offset of each row within a sub image.
+  uint16_t column_sample[512]; ///< Sample of each column in a decoded row.
+
+  TrigTable *trig_table; ///< Shared, null until the P0 tables are loaded.
+  float phase_cos[3], phase_sin[3]; ///< cos and sin of #params phase_in_rad.
+
+  bool enable_bilateral_filter, enable_edge_filter, enable_fast_math, enable_binning, enable_temporal_filter;
+  float temporal_alpha, temporal_threshold; ///< Temporal filter weight and reset distance in millimeters.
+  int frame_width, frame_height; ///< Size of the depth and IR frames, 256x212 if #enable_binning.
+
+  /**
+   * Region of interest, rows [roi_y_begin, roi_y_end) and columns [roi_x_begin, roi_x_end)
+   * in processing order, i.e. row y is row #frame_height - 1 - y of the frames.
+   */
+  int roi_x_begin, roi_x_end, roi_y_begin, roi_y_end;
+  DepthPacketProcessor::Parameters params;
+
+  Frame *ir_frame, *depth_frame, *confidence_frame;
+  Frame::Format ir_format, depth_format; ///< Float or UInt16.
+  bool output_ir, output_depth, output_confidence; ///< Whether the listener wants IR, depth and confidence frames.
+
+  bool flip_ptables;
+
+  libfreenect2::mutex config_mutex; ///< Guards #pending_config and #config_pending.
+  DepthPacketProcessor::Config pending_config; ///< Configuration set by another thread, applied before the next frame.
+  bool config_pending;
+
+  BandWorkerPool *pool; ///< Worker threads for the stages, or null to process on the calling thread only.
+
+  /** IR a and IR b of one row of one frequency, normalized for the bilateral filter. */
+  struct NormalizedRow
+  {
+    float a[512], b[512]; ///< Normalized IR a and IR b.
+    float norm2[512]; ///< Squared norm of IR a and IR b.
+  };
+
+  /**
+   * Rolling row buffers of one band.
+   * The stages are fused: a row passes through all stages as soon as the
+   * rows its 3x3 filters depend on are available, so each intermediate only
+   * keeps a window of three rows, see windowRow().
+   */
+  struct BandBuffers
+  {
+    Planes<float, 9> m; ///< IR a, IR b and IR amplitude of the three frequencies, plane 3 * frequency + component.
+    NormalizedRow *normalized; ///< Normalized rows of #m, index 3 * frequency + row modulo 3.
+    Planes<float, 6> m_filtered; ///< Filtered IR a and IR b of one row, plane 2 * frequency + component.
+    Mat<unsigned char> m_max_edge_test;
+    Planes<float, 3> depth_ir_sum; ///< Raw depth, depth of pixels passing the max edge test, IR sum.
+    Mat<unsigned char> confidence; ///< Frame::ConfidenceFlag of stage 2.
+    float *ir_halo; ///< IR output of rows belonging to a neighbouring band, discarded.
+    float *ir_row, *depth_row; ///< Output rows before the conversion to Frame::UInt16, see outputRow().
+    unsigned char *confidence_row; ///< Confidence output if it is not wanted, discarded.
+
+    /**
+     * Take the buffers from \a arena.
+     * @param whole_frame Keep all rows instead of a rolling window, so the
+     * stages can run one after another on a whole frame.
+     */
+    BandBuffers(ScratchArena &arena, bool whole_frame = false)
+    {
+      const int rows = whole_frame ? 424 : 3, filtered_rows = whole_frame ? 424 : 1;
+
+      m.create(rows, 512, arena.allocate(Planes<float, 9>::sizeInBytes(rows, 512)));
+      normalized = reinterpret_cast<NormalizedRow *>(arena.allocate(9 * sizeof(NormalizedRow)));
+      m_filtered.create(filtered_rows, 512, arena.allocate(Planes<float, 6>::sizeInBytes(filtered_rows, 512)));
+      m_max_edge_test.create(rows, 512, arena.allocate(rows * 512));
+      depth_ir_sum.create(rows, 512, arena.allocate(Planes<float, 3>::sizeInBytes(rows, 512)));
+      confidence.create(rows, 512, arena.allocate(rows * 512));
+      ir_halo = reinterpret_cast<float *>(arena.allocate(512 * sizeof(float)));
+      ir_row = reinterpret_cast<float *>(arena.allocate(512 * sizeof(float)));
+      depth_row = reinterpret_cast<float *>(arena.allocate(512 * sizeof(float)));
+      confidence_row = arena.allocate(512);
+    }
+
+    /** Size of the buffers in a ScratchArena. */
+    static size_t scratchSize(bool whole_frame = false)
+    {
+      const int rows = whole_frame ? 424 : 3, filtered_rows = whole_frame ? 424 : 1;
+
+      return ScratchArena::alignedSize(Planes<float, 9>::sizeInBytes(rows, 512)) +
+          ScratchArena::alignedSize(9 * sizeof(NormalizedRow)) +
+          ScratchArena::alignedSize(Planes<float, 6>::sizeInBytes(filtered_rows, 512)) +
+          ScratchArena::alignedSize(rows * 512) +
+          ScratchArena::alignedSize(Planes<float, 3>::sizeInBytes(rows, 512)) +
+          ScratchArena::alignedSize(rows * 512) +
+          3 * ScratchArena::alignedSize(512 * sizeof(float)) +
+          ScratchArena::alignedSize(512);
+    }
+  };
+
+  struct PipelineSlot;
+
+  /** Run some steps of a whole frame in a pipeline slot, see processSteps(). */
+  typedef void (CpuDepthPacketProcessorImpl::*ProcessStepsFunction)(const unsigned char *data, PipelineSlot &slot, int first, int last);
+
+  /** A frame in flight through the #pipeline. */
+  struct PipelineSlot
+  {
+    BandBuffers *buffers; ///< Whole frame buffers.
+    Frame *ir_frame, *depth_frame, *confidence_frame;
+    bool output_ir, output_depth, output_confidence; ///< Frames the listener wants, see CpuDepthPacketProcessorImpl::output_ir.
+    libfreenect2::FrameListener *listener;
+    ProcessStepsFunction process_steps; ///< Configuration at submission.
+  };
+
+  ScratchArena *scratch; ///< Backing memory of all #band_buffers.
+  std::vector<BandBuffers *> band_buffers; ///< One per band.
+  uint32_t frame_heap_allocations; ///< Scratch heap allocations of the last frame, written with atomicStore().
+
+  /** Process the rows [y_begin, y_end) of a band, see processBand(). */
+  typedef void (CpuDepthPacketProcessorImpl::*ProcessBandFunction)(const unsigned char *data, BandBuffers &buffers, int y_begin, int y_end);
+  ProcessBandFunction process_band; ///< Instantiation of processBand() for the current configuration.
+  ProcessStepsFunction process_steps; ///< Instantiation of processSteps() for the current configuration.
+
+  StagePipeline *pipeline; ///< Pipeline of the stages of consecutive frames, or null to process one frame at a time.
+  std::vector<PipelineSlot> slots; ///< One per frame in flight through the #pipeline.
+
+  /** Context of a band job. */
+  struct BandJob
+  {
+    CpuDepthPacketProcessorImpl *impl;
+    ProcessBandFunction process_band; ///< Configuration at the start of the frame.
+    const unsigned char *data; ///< Raw depth packet.
+  };
+
+  CpuDepthPacketProcessorImpl(int num_threads, int pipeline_stages)
+  {
+    ir_format = Frame::Float;
+    depth_format = Frame::Float;
+    frame_width = 512;
+    frame_height = 424;
+    output_ir = true;
+    output_depth = true;
+    output_confidence = false;
+    newIrFrame();
+    newDepthFrame();
+    newConfidenceFrame();
+
+    enable_bilateral_filter = true;
+    enable_edge_filter = true;
+    enable_fast_math = false;
+    enable_temporal_filter = false;
+    selectProcessFunctions();
+    setBinning(false);
+    setRoi(0, 0, 0, 0);
+    setTemporalFilter(false, 1.0f, 0.0f);
+
+    flip_ptables = true;
+    config_pending = false;
+
+    trig_table = 0;
+    for(int i = 0; i < 3; ++i)
+    {
+      phase_cos[i] = std::cos(params.phase_in_rad[i]);
+      phase_sin[i] = std::sin(params.phase_in_rad[i]);
+    }
+
+    lut11to16[2048] = 0;
+    setDecodeTable(DepthPacketProcessor::DecodeTable());
+
+    // select the fastest row decoder supported by this CPU
+#if defined(LIBFREENECT2_CPU_DEPTH_NEON)
+    decode_row = &decodeRowNeon;
+    LOG_INFO << "using NEON depth decoding";
+#else
+    decode_row = &decodeRowScalar;
+#endif
+#ifdef LIBFREENECT2_CPU_DEPTH_AVX2
+    if(cpuSupportsAvx2())
+    {
+      decode_row = &decodeRowAvx2;
+      LOG_INFO << "using AVX2 depth decoding";
+    }
+#endif
+
+    if(num_threads <= 0)
+    {
+      num_threads = std::max(1u, libfreenect2::thread::hardware_concurrency());
+    }
+
+    if(pipeline_stages < 1 || pipeline_stages > 3)
+    {
+      LOG_WARNING << "invalid number of pipeline stages " << pipeline_stages << ", using " << std::min(std::max(pipeline_stages, 1), 3);
+      pipeline_stages = std::min(std::max(pipeline_stages, 1), 3);
+    }
+
+    if(pipeline_stages > 1 && num_threads > 1)
+    {
+      LOG_WARNING << "the pipelined stages run on one thread each, ignoring " << num_threads << " threads";
+      num_threads = 1;
+    }
+
+    const char *huge_pages = std::getenv("LIBFREENECT2_CPU_HUGE_PAGES");
+    const bool use_huge_pages = huge_pages != 0 && std::string(huge_pages) == "1";
+
+    pool = 0;
+    pipeline = 0;
+
+    if(pipeline_stages > 1)
+    {
+      // one slot per stage, so that every stage can work on its own frame
+      scratch = new ScratchArena(pipeline_stages * BandBuffers::scratchSize(true), use_huge_pages);
+      slots.resize(pipeline_stages);
+
+      for(size_t i = 0; i < slots.size(); ++i)
+      {
+        slots[i].buffers = new BandBuffers(*scratch, true);
+        slots[i].ir_frame = newFrame(Frame::Float, frame_width, frame_height);
+        slots[i].depth_frame = newFrame(Frame::Float, frame_width, frame_height);
+        slots[i].confidence_frame = newFrame(Frame::Gray, frame_width, frame_height);
+        slots[i].output_ir = true;
+        slots[i].output_depth = true;
+        slots[i].output_confidence = false;
+        slots[i].listener = 0;
+        slots[i].process_steps = process_steps;
+      }
+
+      pipeline = new StagePipeline(pipeline_stages, slots.size(), &CpuDepthPacketProcessorImpl::processPipelineStage, this);
+    }
+    else
+    {
+      pool = num_threads > 1 ? new BandWorkerPool(num_threads) : 0;
+      scratch = new ScratchArena(num_threads * BandBuffers::scratchSize(), use_huge_pages);
+
+      for(int i = 0; i < num_threads; ++i)
+      {
+        band_buffers.push_back(new BandBuffers(*scratch));
+      }
+    }
+
+    frame_heap_allocations = 0;
+  }
+
+  /** Allocate a new IR frame. */
+  void newIrFrame()
+  {
+    ir_frame = newFrame(ir_format, frame_width, frame_height);
+  }
+
+  ~CpuDepthPacketProcessorImpl()
+  {
+    delete pipeline;
+    delete pool;
+
+    for(size_t i = 0; i < band_buffers.size(); ++i)
+    {
+      delete band_buffers[i];
+    }
+
+    for(size_t i = 0; i < slots.size(); ++i)
+    {
+      delete slots[i].buffers;
+      delete slots[i].ir_frame;
+      delete slots[i].depth_frame;
+      delete slots[i].confidence_frame;
+    }
+
+    delete scratch;
+
+    if(trig_table != 0)
+    {
+      TrigTable::release(trig_table);
+    }
+
+    delete ir_frame;
+    delete depth_frame;
+    delete confidence_frame;
+  }
+
+  /** Allocate a new depth frame. */
+  void newDepthFrame()
+  {
+    depth_frame = newFrame(depth_format, frame_width, frame_height);
+  }
+
+  void newConfidenceFrame()
+  {
+    confidence_frame = newFrame(Frame::Gray, frame_width, frame_height);
+  }
+
+  /** Allocate a new output frame in \a format. */
+  static Frame *newFrame(Frame::Format format, size_t width, size_t height)
+  {
+    Frame *frame = new Frame(width, height, format == Frame::Gray ? 1 : format == Frame::UInt16 ? 2 : 4);
+    frame->format = format;
+    return frame;
+  }
+
+  /** Replace \a frame by a new frame if it is not in \a format or not of the current frame size. */
+  void ensureFormat(Frame *&frame, Frame::Format format) const
+  {
+    if(frame->format != format || frame->width != size_t(frame_width) || frame->height != size_t(frame_height))
+    {
+      delete frame;
+      frame = newFrame(format, frame_width, frame_height);
+    }
+  }
+
+  /** Output format for the format a listener asks for; UInt16 or Float. */
+  static Frame::Format supportedFormat(Frame::Format format)
+  {
+    return format == Frame::UInt16 ? Frame::UInt16 : Frame::Float;
+  }
+
+  /** Use the outputs and output formats \a listener asks for. */
+  void setOutputFormats(const libfreenect2::FrameListener *listener)
+  {
+    output_ir = listener->wantsFrameType(Frame::Ir);
+    output_depth = listener->wantsFrameType(Frame::Depth);
+    output_confidence = listener->wantsFrameType(Frame::Confidence);
+    ir_format = supportedFormat(listener->getFrameFormat(Frame::Ir));
+    depth_format = supportedFormat(listener->getFrameFormat(Frame::Depth));
+
+    if(output_ir) ensureFormat(ir_frame, ir_format);
+    if(output_depth) ensureFormat(depth_frame, depth_format);
+    if(output_confidence) ensureFormat(confidence_frame, Frame::Gray);
+  }
+
+  /**
+   * Where to compute row \a y of an output frame: the frame row itself for
+   * Frame::Float, or \a scratch_row, which storeRow() converts. Also
+   * \a scratch_row if \a frame is null because nobody wants it.
+   */
+  static float *outputRow(Frame *frame, float *scratch_row, int y)
+  {
+    return frame != 0 && frame->format == Frame::Float ? reinterpret_cast<float *>(frame->data) + (frame->height - 1 - y) * frame->width : scratch_row;
+  }
+
+  /** Row \a y of a confidence frame, or \a scratch_row if there is no frame. */
+  static unsigned char *confidenceRow(Frame *frame, unsigned char *scratch_row, int y)
+  {
+    return frame != 0 ? frame->data + (frame->height - 1 - y) * frame->width : scratch_row;
+  }
+
+  /**
+   * Finish the columns [x_begin, x_end) of depth row \a y, if the edge aware
+   * filter is disabled: apply the temporal filter, store the row and the
+   * confidence of stage 2.
+   * @param depth Depth frame, or null if nobody wants it.
+   * @param confidence Confidence frame, or null if nobody wants it.
+   */
+  void storeStage2Row(BandBuffers &buffers, Frame *depth, Frame *confidence, float *depth_row, int y, int x_begin, int x_end)
+  {
+    if(depth != 0)
+    {
+      temporalFilterRow(y, depth_row, x_begin, x_end);
+      storeRow(depth, depth_row, y, x_begin, x_end);
+    }
+
+    if(confidence != 0)
+    {
+      const unsigned char *stage2_confidence_row = windowRow(buffers.confidence, y);
+      std::copy(stage2_confidence_row + x_begin, stage2_confidence_row + x_end, confidenceRow(confidence, 0, y) + x_begin);
+    }
+  }
+
+  /**
+   * Edge aware filter of the columns [x_begin, x_end) of depth row \a y,
+   * followed by the temporal filter. Stores the row and its confidence.
+   * @param depth Depth frame, or null if nobody wants it.
+   * @param confidence Confidence frame, or null if nobody wants it.
+   */
+  void filterAndStoreStage2Row(BandBuffers &buffers, Frame *depth, Frame *confidence, int y, int x_begin, int x_end)
+  {
+    float *depth_row = outputRow(depth, buffers.depth_row, y);
+    filterStage2Row(buffers, y, depth_row, confidenceRow(confidence, buffers.confidence_row, y), x_begin, x_end);
+
+    if(depth != 0)
+    {
+      temporalFilterRow(y, depth_row, x_begin, x_end);
+      storeRow(depth, depth_row, y, x_begin, x_end);
+    }
+  }
+
+  /** Store the columns [x_begin, x_end) of a row computed in outputRow() to the frame. */
+  static void storeRow(Frame *frame, const float *row, int y, int x_begin, int x_end)
+  {
+    if(frame != 0 && frame->format == Frame::UInt16)
+    {
+      convertRowToUInt16(row, reinterpret_cast<uint16_t *>(frame->data) + (frame->height - 1 - y) * frame->width, x_begin, x_end);
+    }
+  }
+
+  /**
+   * Enable or disable binning, see Freenect2Device::Config. Set the region of
+   * interest afterwards, it is in pixels of the frames.
+   */
+  void setBinning(bool enable)
+  {
+    enable_binning = enable;
+    frame_width = enable ? 256 : 512;
+    frame_height = enable ? 212 : 424;
+    stage2_x_table = enable ? &binned_x_table : &x_table;
+    stage2_z_table = enable ? &binned_z_table : &z_table;
+  }
+
+  /**
+   * Configure the temporal filter, see Freenect2Device::Config. Restarts the
+   * average of all pixels if the filter is turned on or the frame size
+   * changed, so set the frame size before.
+   * @param enable Whether to filter.
+   * @param alpha Weight of the newest depth.
+   * @param threshold Reset distance in millimeters.
+   */
+  void setTemporalFilter(bool enable, float alpha, float threshold)
+  {
+    const bool restart = enable && (!enable_temporal_filter || temporal_depth.height() != frame_height || temporal_depth.width() != frame_width);
+
+    enable_temporal_filter = enable;
+    temporal_alpha = std::min(std::max(alpha, 0.0f), 1.0f);
+    temporal_threshold = threshold;
+
+    if(restart)
+    {
+      temporal_depth.create(frame_height, frame_width);
+      std::fill(temporal_depth.ptr(0, 0), temporal_depth.ptr(0, 0) + frame_height * frame_width, 0.0f);
+    }
+  }
+
+  /**
+   * Set the region of interest in frame coordinates, see Freenect2Device::Config.
+   * The region is clipped to the frame, an empty region selects the whole frame.
+   */
+  void setRoi(int x, int y, int width, int height)
+  {
+    const int x_end = std::min(x + std::max(width, 0), frame_width), y_end = std::min(y + std::max(height, 0), frame_height);
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+
+    if(x >= x_end || y >= y_end)
+    {
+      x = 0;
+      y = 0;
+      width = frame_width;
+      height = frame_height;
+    }
+    else
+    {
+      width = x_end - x;
+      height = y_end - y;
+    }
+
+    roi_x_begin = x;
+    roi_x_end = x + width;
+    roi_y_begin = frame_height - (y + height);
+    roi_y_end = frame_height - y;
+  }
+
+  bool roiIsWholeFrame() const
+  {
+    return roi_x_begin == 0 && roi_x_end == frame_width && roi_y_begin == 0 && roi_y_end == frame_height;
+  }
+
+  /** Rows of the region of interest and \a halo rows above and below it, clipped to the frame. */
+  void roiRows(int halo, int &y_begin, int &y_end) const
+  {
+    y_begin = std::max(roi_y_begin - halo, 0);
+    y_end = std::min(roi_y_end + halo, frame_height);
+  }
+
+  /** Columns of the region of interest and \a halo columns left and right of it, clipped to the frame. */
+  void roiColumns(int halo, int &x_begin, int &x_end) const
+  {
+    x_begin = std::max(roi_x_begin - halo, 0);
+    x_end = std::min(roi_x_end + halo, frame_width);
+  }
+
+  /** Set the pixels of \a frame outside of the region of interest to 0. */
+  void clearOutsideRoi(Frame *frame) const
+  {
+    if(roiIsWholeFrame()) return;
+
+    const size_t bpp = frame->bytes_per_pixel, row_size = frame_width * bpp;
+
+    for(int y = 0; y < frame_height; ++y)
+    {
+      unsigned char *row = frame->data + (frame_height - 1 - y) * row_size;
+
+      if(y < roi_y_begin || y >= roi_y_end)
+      {
+        std::fill(row, row + row_size, 0);
+      }
+      else
+      {
+        std::fill(row, row + roi_x_begin * bpp, 0);
+        std::fill(row + roi_x_end * bpp, row + row_size, 0);
+      }
+    }
+  }
+
+  /**
+   * Set the layout of the raw depth packet. The row decoders read rows of 512
+   * consecutive 11-bit samples, so the table may reorder rows and columns,
+   * but has to keep the samples packed.
+   * @param table Decode table.
+   */
+  void setDecodeTable(const DepthPacketProcessor::DecodeTable &table)
+  {
+    sub_image_words = table.sub_image_words;
+    std::copy(table.row_offset, table.row_offset + 424, row_offset);
+
+    for(int x = 0; x < 512; ++x)
+    {
+      uint32_t bit = table.column_bit[x];
+      column_sample[x] = bit == DepthPacketProcessor::DecodeTable::INVALID_COLUMN ? INVALID_SAMPLE : bit / 11;
+    }
+  }
+
+  /**
+   * Decode row \a y of the first nine sub images.
+   * @param data Raw depth packet.
+   * @param y Vertical position.
+   * @param [out] raw 9 rows of DECODED_ROW_SIZE LUT mapped measurements in sample order, see #column_sample.
+   */
+  void decodeRows(const unsigned char *data, int y, int16_t *raw)
+  {
+    const uint16_t *row = reinterpret_cast<const uint16_t *>(data) + row_offset[y];
+
+    for(int sub = 0; sub < 9; ++sub, row += sub_image_words, raw += DECODED_ROW_SIZE)
+    {
+      decode_row(row, lut11to16, raw);
+      raw[INVALID_SAMPLE] = lut11to16[0];
+    }
+  }
+
+  /**
+   * Fill the trigonometry table of the three P0 tables and share it with other processors.
+   * @param p0_tables Angle at every (x, y) position, for each frequency.
+   */
+  void loadTrigTable(const Mat<uint16_t> p0_tables[3])
+  {
+    TrigTable *table = new TrigTable;
+    int i = 0;
+
+    for(int y = 0; y < 424; ++y)
+      for(int x = 0; x < 512; ++x, ++i)
+        for(int frq = 0; frq < 3; ++frq)
+        {
+          float p0 = -((float)p0_tables[frq].at(y, x)) * 0.000031 * M_PI;
+
+          table->cos_sin[i][frq][0] = std::cos(p0);
+          table->cos_sin[i][frq][1] = std::sin(p0);
+        }
+
+    if(trig_table != 0)
+    {
+      TrigTable::release(trig_table);
+    }
+    trig_table = TrigTable::share(table);
+  }
+
+  /**
+   * Process measurement (all three layers).
+   * @param [in] cos_sin cos and sin of the phase of the pixel, see TrigTable.
+   * @param abMultiplierPerFrq Multiplier.
+   * @param x X position in the image.
+   * @param y Y position in the image.
+   * @param m Measurement.
+   * @param [out] m_out Processed measurement (IR a, IR b, IR amplitude).
+   */
+  void processMeasurementTriple(const float cos_sin[2], float abMultiplierPerFrq, int x, int y, const int32_t* m, float* m_out)
+  {
+    float zmultiplier = z_table.at(y, x);
+    bool cond0 = 0 < zmultiplier;
+    bool cond1 = (m[0] == 32767 || m[1] == 32767 || m[2] == 32767) && cond0;
+
+    // formula given in Patent US 8,587,771 B2:
+    // tmp3 = sum(m[i] * cos(p0 + phase_in_rad[i])), tmp4 = sum(m[i] * sin(-p0 - phase_in_rad[i]))
+    float m_cos = phase_cos[0] * m[0] + phase_cos[1] * m[1] + phase_cos[2] * m[2];
+    float m_sin = phase_sin[0] * m[0] + phase_sin[1] * m[1] + phase_sin[2] * m[2];
+
+    float tmp3 = cos_sin[0] * m_cos - cos_sin[1] * m_sin;
+    float tmp4 = -(cos_sin[1] * m_cos + cos_sin[0] * m_sin);
+
+    // modeMask & 32 is always set
+    tmp3 *= abMultiplierPerFrq;
+    tmp4 *= abMultiplierPerFrq;
+
+    float tmp5 = std::sqrt(tmp3 * tmp3 + tmp4 * tmp4) * params.ab_multiplier;
+
+    // invalid pixel because zmultiplier < 0 ??
+    tmp3 = cond0 ? tmp3 : 0;
+    tmp4 = cond0 ? tmp4 : 0;
+    tmp5 = cond0 ? tmp5 : 0;
+
+    // invalid pixel because saturated?
+    tmp3 = !cond1 ? tmp3 : 0;
+    tmp4 = !cond1 ? tmp4 : 0;
+    tmp5 = !cond1 ? tmp5 : 65535.0; // some kind of norm calculated from tmp3 and tmp4
+
+    m_out[0] = tmp3; // ir image a
+    m_out[1] = tmp4; // ir image b
+    m_out[2] = tmp5; // ir amplitude
+  }
+
+  /**
+   * Transform measurement.
+   * @tparam FastMath Use approximations of the transcendental functions.
+   * @param [in, out] m Measurement.
+   */
+  template<bool FastMath>
+  void transformMeasurements(float* m)
+  {
+    float tmp0 = DepthMath<FastMath>::atan2((m[1]), (m[0]));
+    tmp0 = tmp0 < 0 ? tmp0 + M_PI * 2.0f : tmp0;
+    tmp0 = (tmp0 != tmp0) ? 0 : tmp0;
+
+    float tmp1 = std::sqrt(m[0] * m[0] + m[1] * m[1]) * params.ab_multiplier;
+
+    m[0] = tmp0; // phase
+    m[1] = tmp1; // ir amplitude - (possibly bilateral filtered)
+  }
+
+  /**
+   * Process first pixel stage.
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param raw Decoded measurements of row \a y, see decodeRows().
+   * @param [out] m0_out First layer output.
+   * @param [out] m1_out Second layer output.
+   * @param [out] m2_out Third layer output.
+   */
+  void processPixelStage1(int x, int y, const int16_t *raw, float *m0_out, float *m1_out, float *m2_out)
+  {
+    int32_t m0_raw[3], m1_raw[3], m2_raw[3];
+    const int16_t *r = raw + column_sample[x];
+
+    m0_raw[0] = r[0 * DECODED_ROW_SIZE];
+    m0_raw[1] = r[1 * DECODED_ROW_SIZE];
+    m0_raw[2] = r[2 * DECODED_ROW_SIZE];
+    m1_raw[0] = r[3 * DECODED_ROW_SIZE];
+    m1_raw[1] = r[4 * DECODED_ROW_SIZE];
+    m1_raw[2] = r[5 * DECODED_ROW_SIZE];
+    m2_raw[0] = r[6 * DECODED_ROW_SIZE];
+    m2_raw[1] = r[7 * DECODED_ROW_SIZE];
+    m2_raw[2] = r[8 * DECODED_ROW_SIZE];
+
+    const float (*cos_sin)[2] = trig_table->cos_sin[y * 512 + x];
+
+    processMeasurementTriple(cos_sin[0], params.ab_multiplier_per_frq[0], x, y, m0_raw, m0_out);
+    processMeasurementTriple(cos_sin[1], params.ab_multiplier_per_frq[1], x, y, m1_raw, m1_out);
+    processMeasurementTriple(cos_sin[2], params.ab_multiplier_per_frq[2], x, y, m2_raw, m2_out);
+  }
+
+  /**
+   * Normalize the columns [x_begin, x_end) of a row of IR a and IR b.
+   * @param a IR a row.
+   * @param b IR b row.
+   * @param [out] out Normalized row.
+   * @param x_begin First column.
+   * @param x_end End of the columns.
+   */
+  void normalizeRow(const float *a, const float *b, NormalizedRow &out, int x_begin, int x_end)
+  {
+    for(int x = x_begin; x < x_end; ++x)
+    {
+      float norm2 = a[x] * a[x] + b[x] * b[x];
+      // TODO: maybe fix numeric problems when norm = 0 - original code uses reciprocal square root, which returns +inf for +0
+      float inv_norm = 1.0f / std::sqrt(norm2);
+      inv_norm = (inv_norm == inv_norm) ? inv_norm : std::numeric_limits<float>::infinity();
+
+      out.a[x] = a[x] * inv_norm;
+      out.b[x] = b[x] * inv_norm;
+      out.norm2[x] = norm2;
+    }
+  }
+
+  /**
+   * Filter pixels of one frequency in stage 1.
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param a IR a rows \a y - 1, \a y and \a y + 1.
+   * @param b IR b rows \a y - 1, \a y and \a y + 1.
+   * @param normalized Normalized rows \a y - 1, \a y and \a y + 1.
+   * @param [out] a_out Filtered IR a.
+   * @param [out] b_out Filtered IR b.
+   * @param [out] bilateral_max_edge_test Whether the accumulated distance stayed within limits.
+   */
+  template<bool FastMath>
+  void filterPixelStage1(int x, int y, const float *const a[3], const float *const b[3], const NormalizedRow *const normalized[3], float *a_out, float *b_out, bool &bilateral_max_edge_test)
+  {
+    const float m_a = a[1][x], m_b = b[1][x];
+    bilateral_max_edge_test = true;
+
+    if(x < 1 || y < 1 || x > frame_width - 2 || y > frame_height - 2)
+    {
+      *a_out = m_a;
+      *b_out = m_b;
+    }
+    else
+    {
+      const float norm2 = normalized[1]->norm2[x];
+      const float m_normalized[2] = {normalized[1]->a[x], normalized[1]->b[x]};
+
+      int j = 0;
+
+      float weight_acc = 0.0f;
+      float weighted_m_acc[2] = {0.0f, 0.0f};
+
+      float threshold = (params.joint_bilateral_ab_threshold * params.joint_bilateral_ab_threshold) / (params.ab_multiplier * params.ab_multiplier);
+      float joint_bilateral_exp = params.joint_bilateral_exp;
+
+      if(norm2 < threshold)
+      {
+        threshold = 0.0f;
+        joint_bilateral_exp = 0.0f;
+      }
+
+      float dist_acc = 0.0f;
+
+      for(int yi = -1; yi < 2; ++yi)
+      {
+        const float *other_a_row = a[yi + 1] + x, *other_b_row = b[yi + 1] + x;
+        const NormalizedRow &other_normalized = *normalized[yi + 1];
+
+        for(int xi = -1; xi < 2; ++xi, ++j)
+        {
+          if(yi == 0 && xi == 0)
+          {
+            weight_acc += params.gaussian_kernel[j];
+
+            weighted_m_acc[0] += params.gaussian_kernel[j] * m_a;
+            weighted_m_acc[1] += params.gaussian_kernel[j] * m_b;
+            continue;
+          }
+
+          const float other_a = other_a_row[xi], other_b = other_b_row[xi];
+          const float other_norm2 = other_normalized.norm2[x + xi];
+
+          float dist = -(other_normalized.a[x + xi] * m_normalized[0] + other_normalized.b[x + xi] * m_normalized[1]);
+          dist += 1.0f;
+          dist *= 0.5f;
+
+          float weight = 0.0f;
+
+          if(other_norm2 >= threshold)
+          {
+            weight = (params.gaussian_kernel[j] * DepthMath<FastMath>::exp(-1.442695f * joint_bilateral_exp * dist));
+            dist_acc += dist;
+          }
+
+          weighted_m_acc[0] += weight * other_a;
+          weighted_m_acc[1] += weight * other_b;
+
+          weight_acc += weight;
+        }
+      }
+
+      bilateral_max_edge_test = dist_acc < params.joint_bilateral_max_edge;
+
+      *a_out = 0.0f < weight_acc ? weighted_m_acc[0] / weight_acc : 0.0f;
+      *b_out = 0.0f < weight_acc ? weighted_m_acc[1] / weight_acc : 0.0f;
+    }
+  }
+
+  /**
+   * Process second pixel stage.
+   * @tparam OutputIrSum Whether to output the IR sum for the edge aware filter.
+   * @tparam FastMath Use approximations of the transcendental functions.
+   * @param [out] confidence_out Frame::ConfidenceFlag of the pixel.
+   */
+  template<bool OutputIrSum, bool FastMath>
+  void processPixelStage2(int x, int y, float *m0, float *m1, float *m2, float *ir_out, float *depth_out, float *ir_sum_out, unsigned char *confidence_out)
+  {
+    unsigned char confidence = 0;
+
+    if(m0[2] >= 65535.0f || m1[2] >= 65535.0f || m2[2] >= 65535.0f)
+    {
+      confidence |= Frame::Saturated;
+    }
+
+    //// 10th measurement
+    //float m9 = 1; // decodePixelMeasurement(data, 9, x, y);
+    //
+    //// WTF?
+    //bool cond0 = zmultiplier == 0 || (m9 >= 0 && m9 < 32767);
+    //m9 = std::max(-m9, m9);
+    //// if m9 is positive or pixel is invalid (zmultiplier) we set it to 0 otherwise to its absolute value O.o
+    //m9 = cond0 ? 0 : m9;
+
+    transformMeasurements<FastMath>(m0);
+    transformMeasurements<FastMath>(m1);
+    transformMeasurements<FastMath>(m2);
+
+    float ir_sum = m0[1] + m1[1] + m2[1];
+
+    // disambiguation is always enabled
+    float phase;
+    float ir_min = std::min(std::min(m0[1], m1[1]), m2[1]);
+
+    if (ir_min < params.individual_ab_threshold || ir_sum < params.ab_threshold)
+    {
+      phase = 0;
+      confidence |= Frame::LowAmplitude;
+    }
+    else
+    {
+      float t0 = m0[0] / (2.0f * M_PI) * 3.0f;
+      float t1 = m1[0] / (2.0f * M_PI) * 15.0f;
+      float t2 = m2[0] / (2.0f * M_PI) * 2.0f;
+
+      float t5 = (std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0);
+      float t3 = (-t2 + t5);
+      float t4 = t3 * 2.0f;
+
+      bool c1 = t4 >= -t4; // true if t4 positive
+
+      float f1 = c1 ? 2.0f : -2.0f;
+      float f2 = c1 ? 0.5f : -0.5f;
+      t3 *= f2;
+      t3 = (t3 - std::floor(t3)) * f1;
+
+      bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
+
+      float t6 = c2 ? t5 + 15.0f : t5;
+      float t7 = c2 ? t1 + 15.0f : t1;
+
+      float t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+
+      t6 *= 0.333333f; // = / 3
+      t7 *= 0.066667f; // = / 15
+
+      float t9 = (t8 + t6 + t7); // transformed phase measurements (they are transformed and divided by the values the original values were multiplied with)
+      float t10 = t9 * 0.333333f; // some avg
+
+      t6 *= 2.0f * M_PI;
+      t7 *= 2.0f * M_PI;
+      t8 *= 2.0f * M_PI;
+
+      // some cross product
+      float t8_new = t7 * 0.826977f - t8 * 0.110264f;
+      float t6_new = t8 * 0.551318f - t6 * 0.826977f;
+      float t7_new = t6 * 0.110264f - t7 * 0.551318f;
+
+      t8 = t8_new;
+      t6 = t6_new;
+      t7 = t7_new;
+
+      float norm = t8 * t8 + t6 * t6 + t7 * t7;
+      float mask = t9 >= 0.0f ? 1.0f : 0.0f;
+      t10 *= mask;
+
+      bool slope_positive = 0 < params.ab_confidence_slope;
+
+      float ir_min_ = std::min(std::min(m0[1], m1[1]), m2[1]);
+      float ir_max_ = std::max(std::max(m0[1], m1[1]), m2[1]);
+
+      float ir_x = slope_positive ? ir_min_ : ir_max_;
+
+      ir_x = DepthMath<FastMath>::log(ir_x);
+      ir_x = (ir_x * params.ab_confidence_slope * 0.301030f + params.ab_confidence_offset) * 3.321928f;
+      ir_x = DepthMath<FastMath>::exp(ir_x);
+      ir_x = std::min(params.max_dealias_confidence, std::max(params.min_dealias_confidence, ir_x));
+      ir_x *= ir_x;
+
+      float mask2 = ir_x >= norm ? 1.0f : 0.0f;
+
+      float t11 = t10 * mask2;
+
+      if(mask == 0.0f || mask2 == 0.0f)
+      {
+        confidence |= Frame::Ambiguous;
+      }
+
+      // modeMask & 2 is always set, otherwise t10 would be masked by max_dealias_confidence^2 >= norm
+      phase = t11;
+    }
+
+    // this seems to be the phase to depth mapping :)
+    float zmultiplier = stage2_z_table->at(y, x);
+    float xmultiplier = stage2_x_table->at(y, x);
+
+    phase = 0 < phase ? phase + params.phase_offset : phase;
+
+    float depth_linear = zmultiplier * phase;
+    float max_depth = phase * params.unambigious_dist * 2;
+
+    // modeMask & 32 is always set
+    bool cond1 = 0 < depth_linear && 0 < max_depth;
+
+    xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
+
+    float depth_fit = depth_linear / (-depth_linear * xmultiplier + 1);
+
+    depth_fit = depth_fit < 0 ? 0 : depth_fit;
+    float depth = cond1 ? depth_fit : depth_linear; // r1.y -> later r2.z
+
+    if(0 < depth)
+    {
+      confidence |= Frame::DepthValid;
+      confidence |= depth < params.min_depth || depth > params.max_depth ? Frame::OutOfRange : 0;
+    }
+
+    // depth
+    *depth_out = depth;
+    *confidence_out = confidence;
+    if(OutputIrSum)
+    {
+      *ir_sum_out = ir_sum;
+    }
+
+    // ir
+    //*ir_out = std::min((m1[2]) * ab_output_multiplier, 65535.0f);
+    // ir avg
+    *ir_out = std::min((m0[2] + m1[2] + m2[2]) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
+    //ir_out[0] = std::min(m0[2] * ab_output_multiplier, 65535.0f);
+    //ir_out[1] = std::min(m1[2] * ab_output_multiplier, 65535.0f);
+    //ir_out[2] = std::min(m2[2] * ab_output_multiplier, 65535.0f);
+  }
+
+  /**
+   * Edge aware filter of one pixel.
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param raw_depth Unfiltered depth of the pixel.
+   * @param edge_tested_depth Depth of pixels passing the max edge test, rows \a y - 1, \a y and \a y + 1.
+   * @param ir_sums IR sum, rows \a y - 1, \a y and \a y + 1.
+   * @param max_edge_test_ok Whether the pixel passed the max edge test of the bilateral filter.
+   * @param [out] depth_out Filtered depth.
+   */
+  void filterPixelStage2(int x, int y, float raw_depth, const float *const edge_tested_depth[3], const float *const ir_sums[3], bool max_edge_test_ok, float *depth_out)
+  {
+    const float ir_sum = ir_sums[1][x];
+
+    if(raw_depth >= params.min_depth && raw_depth <= params.max_depth)
+    {
+      if(x < 1 || y < 1 || x > frame_width - 2 || y > frame_height - 2)
+      {
+        *depth_out = raw_depth;
+      }
+      else
+      {
+        float ir_sum_acc = ir_sum, squared_ir_sum_acc = ir_sum * ir_sum, min_depth = raw_depth, max_depth = raw_depth;
+
+        for(int yi = -1; yi < 2; ++yi)
+        {
+          const float *other_depth_row = edge_tested_depth[yi + 1] + x, *other_ir_sum_row = ir_sums[yi + 1] + x;
+
+          for(int xi = -1; xi < 2; ++xi)
+          {
+            if(yi == 0 && xi == 0) continue;
+
+            const float other_depth = other_depth_row[xi], other_ir_sum = other_ir_sum_row[xi];
+
+            ir_sum_acc += other_ir_sum;
+            squared_ir_sum_acc += other_ir_sum * other_ir_sum;
+
+            if(0.0f < other_depth)
+            {
+              min_depth = std::min(min_depth, other_depth);
+              max_depth = std::max(max_depth, other_depth);
+            }
+          }
+        }
+
+        float tmp0 = std::sqrt(squared_ir_sum_acc * 9.0f - ir_sum_acc * ir_sum_acc) / 9.0f;
+        float edge_avg = std::max(ir_sum_acc / 9.0f, params.edge_ab_avg_min_value);
+        tmp0 /= edge_avg;
+
+        float abs_min_diff = std::abs(raw_depth - min_depth);
+        float abs_max_diff = std::abs(raw_depth - max_depth);
+
+        float avg_diff = (abs_min_diff + abs_max_diff) * 0.5f;
+        float max_abs_diff = std::max(abs_min_diff, abs_max_diff);
+
+        bool cond0 =
+            0.0f < raw_depth &&
+            tmp0 >= params.edge_ab_std_dev_threshold &&
+            params.edge_close_delta_threshold < abs_min_diff &&
+            params.edge_far_delta_threshold < abs_max_diff &&
+            params.edge_max_delta_threshold < max_abs_diff &&
+            params.edge_avg_delta_threshold < avg_diff;
+
+        *depth_out = cond0 ? 0.0f : raw_depth;
+
+        if(!cond0)
+        {
+          if(max_edge_test_ok)
+          {
+            //float tmp1 = 1500.0f > raw_depth ? 30.0f : 0.02f * raw_depth;
+            float edge_count = 0.0f;
+
+            *depth_out = edge_count > params.max_edge_count ? 0.0f : raw_depth;
           }
+          else
+          {
+            *depth_out = 0.0f;
+          }
+        }
+      }
+    }
+    else
+    {
+      *depth_out = 0.0f;
+    }
+  }
+
+  /**
+   * Get rows \a y - 1, \a y and \a y + 1 of a rolling row buffer.
+   * Rows outside of the image are replaced by row \a y; the filters do not read them.
+   */
+  template<typename ScalarT>
+  void windowRows(Mat<ScalarT> &m, int y, const ScalarT *rows[3]) const
+  {
+    rows[0] = windowRow(m, std::max(y - 1, 0));
+    rows[1] = windowRow(m, y);
+    rows[2] = windowRow(m, std::min(y + 1, frame_height - 1));
+  }
+
+  /**
+   * Decode row \a y and compute stage 1 of the columns [x_begin, x_end).
+   * @tparam BilateralFilter Whether to normalize the row for the bilateral filter.
+   */
+  template<bool BilateralFilter>
+  void processStage1Row(const unsigned char *data, BandBuffers &buffers, int y, int x_begin, int x_end)
+  {
+    float *m_rows[9];
+
+    for(int i = 0; i < 9; ++i)
+      m_rows[i] = windowRow(buffers.m.plane[i], y);
+
+    if(enable_binning)
+    {
+      processBinnedStage1Row(data, y, x_begin, x_end, m_rows);
+    }
+    else
+    {
+      int16_t raw[9 * DECODED_ROW_SIZE];
+      float m[9];
+
+      decodeRows(data, y, raw);
+
+      for(int x = x_begin; x < x_end; ++x)
+      {
+        processPixelStage1(x, y, raw, m + 0, m + 3, m + 6);
+
+        for(int i = 0; i < 9; ++i)
+          m_rows[i][x] = m[i];
+      }
+    }
+
+    if(BilateralFilter)
+    {
+      for(int frq = 0; frq < 3; ++frq)
+        normalizeRow(m_rows[3 * frq + 0], m_rows[3 * frq + 1], buffers.normalized[3 * frq + y % 3], x_begin, x_end);
+    }
+  }
+
+  /**
+   * Stage 1 of the binned columns [x_begin, x_end) of binned row \a y: the
+   * average IR a, IR b and IR amplitude of 2x2 pixels. Averaging IR a and IR b
+   * adds up the phasors, so the phase is that of the stronger signal.
+   */
+  void processBinnedStage1Row(const unsigned char *data, int y, int x_begin, int x_end, float *const m_rows[9])
+  {
+    int16_t raw[2][9 * DECODED_ROW_SIZE];
+    float m[9];
+
+    decodeRows(data, 2 * y, raw[0]);
+    decodeRows(data, 2 * y + 1, raw[1]);
+
+    for(int x = x_begin; x < x_end; ++x)
+    {
+      float sum[9] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+
+      for(int yi = 0; yi < 2; ++yi)
+        for(int xi = 0; xi < 2; ++xi)
+        {
+          processPixelStage1(2 * x + xi, 2 * y + yi, raw[yi], m + 0, m + 3, m + 6);
+
+          for(int i = 0; i < 9; ++i)
+            sum[i] += m[i];
         }
 
-        bilateral_max_edge_test = bilateral_max_edge_test && dist_acc < params.joint_bilateral_max_edge;
+      for(int i = 0; i < 9; ++i)
+        m_rows[i][x] = 0.25f * sum[i];
+    }
+  }
+
+  /** Bilateral filter of the columns [x_begin, x_end). Needs stage 1 of rows \a y - 1 to \a y + 1 and one more column on each side. */
+  template<bool FastMath>
+  void filterStage1Row(BandBuffers &buffers, int y, int x_begin, int x_end)
+  {
+    unsigned char *m_max_edge_test_row = windowRow(buffers.m_max_edge_test, y);
+    std::fill(m_max_edge_test_row, m_max_edge_test_row + 512, 1);
+
+    for(int frq = 0; frq < 3; ++frq)
+    {
+      const float *a[3], *b[3];
+      windowRows(buffers.m.plane[3 * frq + 0], y, a);
+      windowRows(buffers.m.plane[3 * frq + 1], y, b);
+
+      // the border rows do not read their neighbours
+      const NormalizedRow *const normalized[3] = {
+        &buffers.normalized[3 * frq + std::max(y - 1, 0) % 3],
+        &buffers.normalized[3 * frq + y % 3],
+        &buffers.normalized[3 * frq + std::min(y + 1, frame_height - 1) % 3]
+      };
+
+      float *a_out = windowRow(buffers.m_filtered.plane[2 * frq + 0], y);
+      float *b_out = windowRow(buffers.m_filtered.plane[2 * frq + 1], y);
+
+      for(int x = x_begin; x < x_end; ++x)
+      {
+        bool max_edge_test_val = true;
+        filterPixelStage1<FastMath>(x, y, a, b, normalized, a_out + x, b_out + x, max_edge_test_val);
+        m_max_edge_test_row[x] &= max_edge_test_val ? 1 : 0;
+      }
+    }
+  }
+
+  /**
+   * Compute depth and IR of row \a y. Needs the bilateral filter of row \a y, if it is enabled.
+   * @param buffers Band buffers.
+   * @param y Vertical position.
+   * @param ir_row IR output row.
+   * @param depth_row Depth output row, only used if the edge aware filter is disabled.
+   * @param x_begin First column.
+   * @param x_end End of the columns.
+   */
+  template<bool BilateralFilter, bool EdgeAwareFilter, bool FastMath>
+  void processStage2Row(BandBuffers &buffers, int y, float *ir_row, float *depth_row, int x_begin, int x_end)
+  {
+    float m[9];
+    const float *m_rows[9];
+    unsigned char *confidence_row = windowRow(buffers.confidence, y);
+
+    for(int i = 0; i < 9; ++i)
+      m_rows[i] = windowRow(buffers.m.plane[i], y);
+
+    if(BilateralFilter)
+    {
+      for(int frq = 0; frq < 3; ++frq)
+      {
+        m_rows[3 * frq + 0] = windowRow(buffers.m_filtered.plane[2 * frq + 0], y);
+        m_rows[3 * frq + 1] = windowRow(buffers.m_filtered.plane[2 * frq + 1], y);
+      }
+    }
+    else
+    {
+      unsigned char *m_max_edge_test_row = windowRow(buffers.m_max_edge_test, y);
+      std::fill(m_max_edge_test_row, m_max_edge_test_row + 512, 1);
+    }
+
+    if(EdgeAwareFilter)
+    {
+      const unsigned char *m_max_edge_test_row = windowRow(buffers.m_max_edge_test, y);
+      float *raw_depth_row = windowRow(buffers.depth_ir_sum.plane[0], y);
+      float *edge_tested_depth_row = windowRow(buffers.depth_ir_sum.plane[1], y);
+      float *ir_sum_row = windowRow(buffers.depth_ir_sum.plane[2], y);
+
+      for(int x = x_begin; x < x_end; ++x)
+      {
+        for(int i = 0; i < 9; ++i)
+          m[i] = m_rows[i][x];
+
+        processPixelStage2<true, FastMath>(x, y, m + 0, m + 3, m + 6, ir_row + x, raw_depth_row + x, ir_sum_row + x, confidence_row + x);
 
-        m_out[0] = 0.0f < weight_acc ? weighted_m_acc[0] / weight_acc : 0.0f;
-        m_out[1] = 0.0f < weight_acc ? weighted_m_acc[1] / weight_acc : 0.0f;
-        m_out[2] = m_ptr[2];
+        edge_tested_depth_row[x] = m_max_edge_test_row[x] == 1 ? raw_depth_row[x] : 0;
+      }
+    }
+    else
+    {
+      for(int x = x_begin; x < x_end; ++x)
+      {
+        for(int i = 0; i < 9; ++i)
+          m[i] = m_rows[i][x];
+
+        processPixelStage2<false, FastMath>(x, y, m + 0, m + 3, m + 6, ir_row + x, depth_row + x, 0, confidence_row + x);
       }
     }
   }
 
-  void processPixelStage2(int x, int y, float *m0, float *m1, float *m2, float *ir_out, float *depth_out, float *ir_sum_out)
+  /**
+   * Temporal filter of the columns [x_begin, x_end) of the final depth row \a y.
+   * Updates the average of each pixel in place and replaces the depth by it.
+   * Rows must be filtered in frame order, at most once per frame.
+   */
+  void temporalFilterRow(int y, float *depth_row, int x_begin, int x_end)
   {
-    //// 10th measurement
-    //float m9 = 1; // decodePixelMeasurement(data, 9, x, y);
-    //
-    //// WTF?
-    //bool cond0 = zmultiplier == 0 || (m9 >= 0 && m9 < 32767);
-    //m9 = std::max(-m9, m9);
-    //// if m9 is positive or pixel is invalid (zmultiplier) we set it to 0 otherwise to its absolute value O.o
-    //m9 = cond0 ? 0 : m9;
+    if(!enable_temporal_filter) return;
 
-    transformMeasurements(m0);
-    transformMeasurements(m1);
-    transformMeasurements(m2);
+    float *average = temporal_depth.ptr(y, 0);
 
-    float ir_sum = m0[1] + m1[1] + m2[1];
+    for(int x = x_begin; x < x_end; ++x)
+    {
+      float depth = depth_row[x];
 
-    float phase;
-    // if(DISABLE_DISAMBIGUATION)
-    if(false)
-    {
-#if 0
-        //r0.yz = r3.zx + r4.zx // add
-        //r0.yz = r5.xz + r0.zy // add
-        float phase = m0[0] + m1[0] + m2[0]; // r0.y
-        float tmp1 = m0[2] + m1[2] + m2[2];  // r0.z
-
-        //r7.xyz = r3.zxy + r4.zxy // add
-        //r4.xyz = r5.zyx + r7.xzy // add
-        float tmp2 = m0[0] + m1[0] + m2[0]; // r4.z
-        //r3.zw = r4.xy // mov
-        float tmp3 = m0[2] + m1[2] + m2[2]; // r3.z
-        float tmp4 = m0[1] + m1[1] + m2[1]; // r3.w
-#endif
+      if(!(depth > 0))
+      {
+        average[x] = 0;
+        continue;
+      }
+
+      if(average[x] > 0 && std::abs(depth - average[x]) <= temporal_threshold)
+      {
+        depth = average[x] + temporal_alpha * (depth - average[x]);
+      }
+
+      average[x] = depth;
+      depth_row[x] = depth;
     }
-    else
+  }
+
+  /**
+   * Edge aware filter of the columns [x_begin, x_end). Needs stage 2 of rows \a y - 1 to \a y + 1 and one more column on each side.
+   * @param buffers Band buffers.
+   * @param y Vertical position.
+   * @param depth_row Depth output row.
+   * @param confidence_row Confidence output row.
+   * @param x_begin First column.
+   * @param x_end End of the columns.
+   */
+  void filterStage2Row(BandBuffers &buffers, int y, float *depth_row, unsigned char *confidence_row, int x_begin, int x_end)
+  {
+    const unsigned char *stage2_confidence_row = windowRow(buffers.confidence, y);
+    const unsigned char *m_max_edge_test_row = windowRow(buffers.m_max_edge_test, y);
+    const float *raw_depth_row = windowRow(buffers.depth_ir_sum.plane[0], y);
+    const float *edge_tested_depth[3], *ir_sums[3];
+    windowRows(buffers.depth_ir_sum.plane[1], y, edge_tested_depth);
+    windowRows(buffers.depth_ir_sum.plane[2], y, ir_sums);
+
+    for(int x = x_begin; x < x_end; ++x)
     {
-      float ir_min = std::min(std::min(m0[1], m1[1]), m2[1]);
+      filterPixelStage2(x, y, raw_depth_row[x], edge_tested_depth, ir_sums, m_max_edge_test_row[x] == 1, depth_row + x);
+
+      unsigned char confidence = stage2_confidence_row[x];
 
-      if (ir_min < params.individual_ab_threshold || ir_sum < params.ab_threshold)
+      if(!(0 < depth_row[x]))
       {
-        phase = 0;
+        confidence &= ~Frame::DepthValid;
+
+        // the filter only removes depth in range for failing an edge test, stage 2 flags the other rejects
+        if(0 < raw_depth_row[x] && (confidence & Frame::OutOfRange) == 0)
+        {
+          confidence |= Frame::Edge;
+        }
       }
-      else
-      {
-        float t0 = m0[0] / (2.0f * M_PI) * 3.0f;
-        float t1 = m1[0] / (2.0f * M_PI) * 15.0f;
-        float t2 = m2[0] / (2.0f * M_PI) * 2.0f;
 
-        float t5 = (std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0);
-        float t3 = (-t2 + t5);
-        float t4 = t3 * 2.0f;
+      confidence_row[x] = confidence;
+    }
+  }
+
+  /**
+   * Process the rows [y_begin, y_end) of the region of interest through all stages.
+   * The 3x3 filters need neighbouring pixels, so each enabled filter extends the
+   * rows and columns computed by the preceding stages by one on each side.
+   * The halo rows are computed again by the neighbouring band.
+   * @tparam BilateralFilter Whether the bilateral filter is enabled.
+   * @tparam EdgeAwareFilter Whether the edge aware filter is enabled.
+   * @tparam FastMath Use approximations of the transcendental functions.
+   */
+  template<bool BilateralFilter, bool EdgeAwareFilter, bool FastMath>
+  void processBand(const unsigned char *data, BandBuffers &buffers, int y_begin, int y_end)
+  {
+    // rows stage 2 lags behind stage 1, and the edge aware filter behind stage 2
+    const int lag1 = BilateralFilter ? 1 : 0;
+    const int lag2 = EdgeAwareFilter ? 1 : 0;
 
-        bool c1 = t4 >= -t4; // true if t4 positive
+    const int stage2_begin = std::max(y_begin - lag2, 0), stage2_end = std::min(y_end + lag2, frame_height);
 
-        float f1 = c1 ? 2.0f : -2.0f;
-        float f2 = c1 ? 0.5f : -0.5f;
-        t3 *= f2;
-        t3 = (t3 - std::floor(t3)) * f1;
+    int x1_begin, x1_end, x2_begin, x2_end, x3_begin, x3_end;
+    roiColumns(lag1 + lag2, x1_begin, x1_end);
+    roiColumns(lag2, x2_begin, x2_end);
+    roiColumns(0, x3_begin, x3_end);
 
-        bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
+    Frame *depth = output_depth ? depth_frame : 0, *confidence = output_confidence ? confidence_frame : 0;
 
-        float t6 = c2 ? t5 + 15.0f : t5;
-        float t7 = c2 ? t1 + 15.0f : t1;
+    for(int y = y_begin - lag1 - lag2; y < y_end + lag1 + lag2; ++y)
+    {
+      if(0 <= y && y < frame_height)
+      {
+        processStage1Row<BilateralFilter>(data, buffers, y, x1_begin, x1_end);
+      }
 
-        float t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+      const int y2 = y - lag1;
 
-        t6 *= 0.333333f; // = / 3
-        t7 *= 0.066667f; // = / 15
+      if(stage2_begin <= y2 && y2 < stage2_end)
+      {
+        if(BilateralFilter)
+        {
+          filterStage1Row<FastMath>(buffers, y2, x2_begin, x2_end);
+        }
 
-        float t9 = (t8 + t6 + t7); // transformed phase measurements (they are transformed and divided by the values the original values were multiplied with)
-        float t10 = t9 * 0.333333f; // some avg
+        bool store_ir = output_ir && y_begin <= y2 && y2 < y_end;
+        float *ir_row = store_ir ? outputRow(ir_frame, buffers.ir_row, y2) : buffers.ir_halo;
+        float *depth_row = outputRow(depth, buffers.depth_row, y2);
 
-        t6 *= 2.0f * M_PI;
-        t7 *= 2.0f * M_PI;
-        t8 *= 2.0f * M_PI;
+        processStage2Row<BilateralFilter, EdgeAwareFilter, FastMath>(buffers, y2, ir_row, depth_row, x2_begin, x2_end);
 
-        // some cross product
-        float t8_new = t7 * 0.826977f - t8 * 0.110264f;
-        float t6_new = t8 * 0.551318f - t6 * 0.826977f;
-        float t7_new = t6 * 0.110264f - t7 * 0.551318f;
+        if(store_ir) storeRow(ir_frame, ir_row, y2, x3_begin, x3_end);
+        if(!EdgeAwareFilter) storeStage2Row(buffers, depth, confidence, depth_row, y2, x3_begin, x3_end);
+      }
 
-        t8 = t8_new;
-        t6 = t6_new;
-        t7 = t7_new;
+      const int y3 = y2 - lag2;
 
-        float norm = t8 * t8 + t6 * t6 + t7 * t7;
-        float mask = t9 >= 0.0f ? 1.0f : 0.0f;
-        t10 *= mask;
+      if(EdgeAwareFilter && y_begin <= y3 && y3 < y_end)
+      {
+        filterAndStoreStage2Row(buffers, depth, confidence, y3, x3_begin, x3_end);
+      }
+    }
+  }
 
-        bool slope_positive = 0 < params.ab_confidence_slope;
+  static void processBandJob(void *context, int band, int y_begin, int y_end)
+  {
+    BandJob *job = static_cast<BandJob *>(context);
+    CpuDepthPacketProcessorImpl *impl = job->impl;
+    BandBuffers &buffers = *impl->band_buffers[band];
 
-        float ir_min_ = std::min(std::min(m0[1], m1[1]), m2[1]);
-        float ir_max_ = std::max(std::max(m0[1], m1[1]), m2[1]);
+    if(impl->output_depth || impl->output_confidence)
+      (impl->*(job->process_band))(job->data, buffers, impl->roi_y_begin + y_begin, impl->roi_y_begin + y_end);
+    else
+      impl->processIrRows(job->data, buffers, impl->ir_frame, impl->roi_y_begin + y_begin, impl->roi_y_begin + y_end);
+  }
 
-        float ir_x = slope_positive ? ir_min_ : ir_max_;
+  /**
+   * Compute only the IR output of the rows [y_begin, y_end) of the region of
+   * interest. IR is the amplitude of stage 1, so neither the filters nor the
+   * phase unwrapping of stage 2 are needed.
+   */
+  void processIrRows(const unsigned char *data, BandBuffers &buffers, Frame *frame, int y_begin, int y_end)
+  {
+    int x_begin, x_end;
+    roiColumns(0, x_begin, x_end);
 
-        ir_x = std::log(ir_x);
-        ir_x = (ir_x * params.ab_confidence_slope * 0.301030f + params.ab_confidence_offset) * 3.321928f;
-        ir_x = std::exp(ir_x);
-        ir_x = std::min(params.max_dealias_confidence, std::max(params.min_dealias_confidence, ir_x));
-        ir_x *= ir_x;
+    for(int y = y_begin; y < y_end; ++y)
+    {
+      processStage1Row<false>(data, buffers, y, x_begin, x_end);
 
-        float mask2 = ir_x >= norm ? 1.0f : 0.0f;
+      const float *m0 = windowRow(buffers.m.plane[2], y);
+      const float *m1 = windowRow(buffers.m.plane[5], y);
+      const float *m2 = windowRow(buffers.m.plane[8], y);
+      float *ir_row = outputRow(frame, buffers.ir_row, y);
 
-        float t11 = t10 * mask2;
+      // same as processPixelStage2()
+      for(int x = x_begin; x < x_end; ++x)
+        ir_row[x] = std::min((m0[x] + m1[x] + m2[x]) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
 
-        float mask3 = params.max_dealias_confidence * params.max_dealias_confidence >= norm ? 1.0f : 0.0f;
-        t10 *= mask3;
-        phase = true/*(modeMask & 2) != 0*/ ? t11 : t10;
-      }
+      storeRow(frame, ir_row, y, x_begin, x_end);
     }
+  }
 
-    // this seems to be the phase to depth mapping :)
-    float zmultiplier = z_table.at(y, x);
-    float xmultiplier = x_table.at(y, x);
+  /**
+   * Run the steps [first, last) on the region of interest of a pipeline slot.
+   * Step 0 decodes the packet and computes stage 1 and the bilateral filter,
+   * step 1 computes stage 2, step 2 applies the edge aware filter.
+   * @param data Raw depth packet, only read by step 0.
+   * @param slot Pipeline slot.
+   * @param first First step.
+   * @param last End of the steps.
+   */
+  template<bool BilateralFilter, bool EdgeAwareFilter, bool FastMath>
+  void processSteps(const unsigned char *data, PipelineSlot &slot, int first, int last)
+  {
+    BandBuffers &buffers = *slot.buffers;
 
-    phase = 0 < phase ? phase + params.phase_offset : phase;
+    if(!slot.output_depth && !slot.output_confidence)
+    {
+      int y_begin, y_end;
+      roiRows(0, y_begin, y_end);
 
-    float depth_linear = zmultiplier * phase;
-    float max_depth = phase * params.unambigious_dist * 2;
+      if(first <= 0 && 0 < last)
+        processIrRows(data, buffers, slot.ir_frame, y_begin, y_end);
+      return;
+    }
 
-    bool cond1 = /*(modeMask & 32) != 0*/ true && 0 < depth_linear && 0 < max_depth;
+    const int lag1 = BilateralFilter ? 1 : 0;
+    const int lag2 = EdgeAwareFilter ? 1 : 0;
 
-    xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
+    int x1_begin, x1_end, x2_begin, x2_end, x3_begin, x3_end;
+    roiColumns(lag1 + lag2, x1_begin, x1_end);
+    roiColumns(lag2, x2_begin, x2_end);
+    roiColumns(0, x3_begin, x3_end);
 
-    float depth_fit = depth_linear / (-depth_linear * xmultiplier + 1);
+    int y1_begin, y1_end, y2_begin, y2_end, y3_begin, y3_end;
+    roiRows(lag1 + lag2, y1_begin, y1_end);
+    roiRows(lag2, y2_begin, y2_end);
+    roiRows(0, y3_begin, y3_end);
 
-    depth_fit = depth_fit < 0 ? 0 : depth_fit;
-    float depth = cond1 ? depth_fit : depth_linear; // r1.y -> later r2.z
+    Frame *depth = slot.output_depth ? slot.depth_frame : 0, *confidence = slot.output_confidence ? slot.confidence_frame : 0;
 
-    // depth
-    *depth_out = depth;
-    if(ir_sum_out != 0)
+    if(first <= 0 && 0 < last)
     {
-      *ir_sum_out = ir_sum;
+      for(int y = y1_begin; y < y1_end + lag1; ++y)
+      {
+        if(y < y1_end)
+        {
+          processStage1Row<BilateralFilter>(data, buffers, y, x1_begin, x1_end);
+        }
+
+        if(BilateralFilter && y2_begin <= y - 1 && y - 1 < y2_end)
+        {
+          filterStage1Row<FastMath>(buffers, y - 1, x2_begin, x2_end);
+        }
+      }
     }
 
-    // ir
-    //*ir_out = std::min((m1[2]) * ab_output_multiplier, 65535.0f);
-    // ir avg
-    *ir_out = std::min((m0[2] + m1[2] + m2[2]) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
-    //ir_out[0] = std::min(m0[2] * ab_output_multiplier, 65535.0f);
-    //ir_out[1] = std::min(m1[2] * ab_output_multiplier, 65535.0f);
-    //ir_out[2] = std::min(m2[2] * ab_output_multiplier, 65535.0f);
-  }
+    if(first <= 1 && 1 < last)
+    {
+      for(int y = y2_begin; y < y2_end; ++y)
+      {
+        float *ir_row = slot.output_ir ? outputRow(slot.ir_frame, buffers.ir_row, y) : buffers.ir_halo;
+        float *depth_row = outputRow(depth, buffers.depth_row, y);
 
-  void filterPixelStage2(int x, int y, Mat<Vec<float, 3> > &m, bool max_edge_test_ok, float *depth_out)
-  {
-    Vec<float, 3> &depth_and_ir_sum = m.at(y, x);
-    float &raw_depth = depth_and_ir_sum.val[0], &ir_sum = depth_and_ir_sum.val[2];
+        processStage2Row<BilateralFilter, EdgeAwareFilter, FastMath>(buffers, y, ir_row, depth_row, x2_begin, x2_end);
 
-    if(raw_depth >= params.min_depth && raw_depth <= params.max_depth)
+        if(slot.output_ir) storeRow(slot.ir_frame, ir_row, y, x3_begin, x3_end);
+        if(!EdgeAwareFilter) storeStage2Row(buffers, depth, confidence, depth_row, y, x3_begin, x3_end);
+      }
+    }
+
+    if(EdgeAwareFilter && first <= 2 && 2 < last)
     {
-      if(x < 1 || y < 1 || x > 510 || y > 422)
+      for(int y = y3_begin; y < y3_end; ++y)
       {
-        *depth_out = raw_depth;
+        filterAndStoreStage2Row(buffers, depth, confidence, y, x3_begin, x3_end);
       }
+    }
+  }
+
+  /** Select the processBand() and processSteps() instantiations matching the configuration. */
+  void selectProcessFunctions()
+  {
+    if(enable_fast_math)
+      selectProcessFunctions<true>();
+    else
+      selectProcessFunctions<false>();
+  }
+
+  template<bool FastMath>
+  void selectProcessFunctions()
+  {
+    if(enable_bilateral_filter)
+    {
+      if(enable_edge_filter)
+        setProcessFunctions<true, true, FastMath>();
+      else
+        setProcessFunctions<true, false, FastMath>();
+    }
+    else
+    {
+      if(enable_edge_filter)
+        setProcessFunctions<false, true, FastMath>();
       else
+        setProcessFunctions<false, false, FastMath>();
+    }
+  }
+
+  template<bool BilateralFilter, bool EdgeAwareFilter, bool FastMath>
+  void setProcessFunctions()
+  {
+    process_band = &CpuDepthPacketProcessorImpl::processBand<BilateralFilter, EdgeAwareFilter, FastMath>;
+    process_steps = &CpuDepthPacketProcessorImpl::processSteps<BilateralFilter, EdgeAwareFilter, FastMath>;
+  }
+
+  /**
+   * Execute a later stage of the #pipeline. Each stage runs one step, the last
+   * stage runs the remaining steps and passes the frames to the listener.
+   */
+  static void processPipelineStage(void *context, int stage, int slot_index)
+  {
+    CpuDepthPacketProcessorImpl *impl = static_cast<CpuDepthPacketProcessorImpl *>(context);
+    PipelineSlot &slot = impl->slots[slot_index];
+    const bool last_stage = stage + 1 == impl->pipeline->numStages();
+
+    (impl->*(slot.process_steps))(0, slot, stage, last_stage ? 3 : stage + 1);
+
+    if(last_stage)
+    {
+      // the listener may delete the frames it takes
+      Frame::Format ir_format = slot.ir_frame->format, depth_format = slot.depth_frame->format;
+      const size_t width = impl->frame_width, height = impl->frame_height;
+
+      if(slot.output_ir)
       {
-        float ir_sum_acc = ir_sum, squared_ir_sum_acc = ir_sum * ir_sum, min_depth = raw_depth, max_depth = raw_depth;
+        impl->clearOutsideRoi(slot.ir_frame);
 
-        for(int yi = -1; yi < 2; ++yi)
+        if(slot.listener->onNewFrame(Frame::Ir, slot.ir_frame))
         {
-          for(int xi = -1; xi < 2; ++xi)
-          {
-            if(yi == 0 && xi == 0) continue;
+          slot.ir_frame = newFrame(ir_format, width, height);
+        }
+      }
 
-            Vec<float, 3> &other = m.at(y + yi, x + xi);
+      if(slot.output_depth)
+      {
+        impl->clearOutsideRoi(slot.depth_frame);
 
-            ir_sum_acc += other.val[2];
-            squared_ir_sum_acc += other.val[2] * other.val[2];
+        if(slot.listener->onNewFrame(Frame::Depth, slot.depth_frame))
+        {
+          slot.depth_frame = newFrame(depth_format, width, height);
+        }
+      }
 
-            if(0.0f < other.val[1])
-            {
-              min_depth = std::min(min_depth, other.val[1]);
-              max_depth = std::max(max_depth, other.val[1]);
-            }
-          }
+      if(slot.output_confidence)
+      {
+        impl->clearOutsideRoi(slot.confidence_frame);
+
+        if(slot.listener->onNewFrame(Frame::Confidence, slot.confidence_frame))
+        {
+          slot.confidence_frame = newFrame(Frame::Gray, width, height);
         }
+      }
+    }
+  }
 
-        float tmp0 = std::sqrt(squared_ir_sum_acc * 9.0f - ir_sum_acc * ir_sum_acc) / 9.0f;
-        float edge_avg = std::max(ir_sum_acc / 9.0f, params.edge_ab_avg_min_value);
-        tmp0 /= edge_avg;
+  /**
+   * Run stage 0 of a depth packet and pass it on to the later stages of the
+   * #pipeline. Blocks while all slots are in use.
+   */
+  void submitFrame(const DepthPacket &packet, libfreenect2::FrameListener *listener)
+  {
+    int slot_index = pipeline->acquireSlot();
+    PipelineSlot &slot = slots[slot_index];
+
+    slot.output_ir = listener->wantsFrameType(Frame::Ir);
+    slot.output_depth = listener->wantsFrameType(Frame::Depth);
+    slot.output_confidence = listener->wantsFrameType(Frame::Confidence);
+    if(slot.output_ir) ensureFormat(slot.ir_frame, supportedFormat(listener->getFrameFormat(Frame::Ir)));
+    if(slot.output_depth) ensureFormat(slot.depth_frame, supportedFormat(listener->getFrameFormat(Frame::Depth)));
+    if(slot.output_confidence) ensureFormat(slot.confidence_frame, Frame::Gray);
+
+    slot.ir_frame->timestamp = packet.timestamp;
+    slot.depth_frame->timestamp = packet.timestamp;
+    slot.ir_frame->sequence = packet.sequence;
+    slot.depth_frame->sequence = packet.sequence;
+    slot.confidence_frame->timestamp = packet.timestamp;
+    slot.confidence_frame->sequence = packet.sequence;
+    slot.listener = listener;
+    slot.process_steps = process_steps;
+
+    (this->*(slot.process_steps))(packet.buffer, slot, 0, 1);
+
+    pipeline->submitSlot(slot_index);
+  }
 
-        float abs_min_diff = std::abs(raw_depth - min_depth);
-        float abs_max_diff = std::abs(raw_depth - max_depth);
+  /** Wait for the frames in flight before changing the tables or the configuration. */
+  void flushPipeline()
+  {
+    if(pipeline != 0)
+    {
+      pipeline->flush();
+    }
+  }
 
-        float avg_diff = (abs_min_diff + abs_max_diff) * 0.5f;
-        float max_abs_diff = std::max(abs_min_diff, abs_max_diff);
+  /** Apply \a config, no frame may be in flight. */
+  void applyConfiguration(const DepthPacketProcessor::Config &config)
+  {
+    params.min_depth = config.MinDepth * 1000.0f;
+    params.max_depth = config.MaxDepth * 1000.0f;
+    enable_bilateral_filter = config.EnableBilateralFilter;
+    enable_edge_filter = config.EnableEdgeAwareFilter;
+    enable_fast_math = config.EnableFastMath;
+    selectProcessFunctions();
+    setBinning(config.EnableBinning);
+    setRoi(config.RoiX, config.RoiY, config.RoiWidth, config.RoiHeight);
+    setTemporalFilter(config.EnableTemporalFilter, config.TemporalFilterAlpha, config.TemporalFilterThreshold * 1000.0f);
+  }
 
-        bool cond0 =
-            0.0f < raw_depth &&
-            tmp0 >= params.edge_ab_std_dev_threshold &&
-            params.edge_close_delta_threshold < abs_min_diff &&
-            params.edge_far_delta_threshold < abs_max_diff &&
-            params.edge_max_delta_threshold < max_abs_diff &&
-            params.edge_avg_delta_threshold < avg_diff;
+  /**
+   * Apply the configuration of the last setConfiguration() call, if any, on
+   * the thread calling process(). The frame size and the buffers of the
+   * region of interest and the temporal filter only change between frames.
+   */
+  void applyPendingConfiguration()
+  {
+    DepthPacketProcessor::Config config;
 
-        *depth_out = cond0 ? 0.0f : raw_depth;
+    {
+      libfreenect2::lock_guard l(config_mutex);
+      if(!config_pending) return;
+      config = pending_config;
+      config_pending = false;
+    }
 
-        if(!cond0)
-        {
-          if(max_edge_test_ok)
-          {
-            //float tmp1 = 1500.0f > raw_depth ? 30.0f : 0.02f * raw_depth;
-            float edge_count = 0.0f;
+    flushPipeline();
+    applyConfiguration(config);
+  }
 
-            *depth_out = edge_count > params.max_edge_count ? 0.0f : raw_depth;
-          }
-          else
-          {
-            *depth_out = !max_edge_test_ok ? 0.0f : raw_depth;
-            *depth_out = true ? *depth_out : raw_depth;
-          }
-        }
-      }
+  /** Process a depth packet, split into bands if there is a worker pool. */
+  void processFrame(const unsigned char *data)
+  {
+    size_t heap_allocations = scratch->heapAllocations();
+    BandJob job;
+    job.impl = this;
+    job.process_band = process_band;
+    job.data = data;
+
+    if(pool != 0)
+    {
+      pool->run(&CpuDepthPacketProcessorImpl::processBandJob, &job, roi_y_end - roi_y_begin);
     }
     else
     {
-      *depth_out = 0.0f;
+      processBandJob(&job, 0, 0, roi_y_end - roi_y_begin);
     }
 
-    // override raw depth
-    depth_and_ir_sum.val[0] = depth_and_ir_sum.val[1];
+    // the filters also write the halo around the region of interest
+    if(output_ir) clearOutsideRoi(ir_frame);
+    if(output_depth) clearOutsideRoi(depth_frame);
+    if(output_confidence) clearOutsideRoi(confidence_frame);
+
+    // read by getFrameHeapAllocations() on any thread
+    atomicStore(frame_heap_allocations, static_cast<uint32_t>(scratch->heapAllocations() - heap_allocations));
   }
 };
 
-CpuDepthPacketProcessor::CpuDepthPacketProcessor() :
-    impl_(new CpuDepthPacketProcessorImpl())
+CpuDepthPacketProcessor::CpuDepthPacketProcessor(const int num_threads, const int pipeline_stages) :
+    impl_(new CpuDepthPacketProcessorImpl(num_threads, pipeline_stages))
 {
 }
 
@@ -843,11 +2795,11 @@ CpuDepthPacketProcessor::~CpuDepthPacketProcessor()
 void CpuDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config)
 {
   DepthPacketProcessor::setConfiguration(config);
-  
-  impl_->params.min_depth = config.MinDepth * 1000.0f;
-  impl_->params.max_depth = config.MaxDepth * 1000.0f;
-  impl_->enable_bilateral_filter = config.EnableBilateralFilter;
-  impl_->enable_edge_filter = config.EnableEdgeAwareFilter;
+
+  // process() may be running on another thread, it applies the configuration before the next frame
+  libfreenect2::lock_guard l(impl_->config_mutex);
+  impl_->pending_config = config;
+  impl_->config_pending = true;
 }
 
 /**
@@ -866,36 +2818,53 @@ void CpuDepthPacketProcessor::loadP0TablesFromCommandResponse(unsigned char* buf
     return;
   }
 
+  Mat<uint16_t> p0_tables[3];
+
   if(impl_->flip_ptables)
   {
-    flipHorizontal(Mat<uint16_t>(424, 512, p0table->p0table0), impl_->p0_table0);
-    flipHorizontal(Mat<uint16_t>(424, 512, p0table->p0table1), impl_->p0_table1);
-    flipHorizontal(Mat<uint16_t>(424, 512, p0table->p0table2), impl_->p0_table2);
+    flipHorizontal(Mat<uint16_t>(424, 512, p0table->p0table0), p0_tables[0]);
+    flipHorizontal(Mat<uint16_t>(424, 512, p0table->p0table1), p0_tables[1]);
+    flipHorizontal(Mat<uint16_t>(424, 512, p0table->p0table2), p0_tables[2]);
   }
   else
   {
-    Mat<uint16_t> p00(424, 512, p0table->p0table0);
-    p00.copyTo(impl_->p0_table0);
-    Mat<uint16_t>(424, 512, p0table->p0table1).copyTo(impl_->p0_table1);
-    Mat<uint16_t>(424, 512, p0table->p0table2).copyTo(impl_->p0_table2);
+    Mat<uint16_t>(424, 512, p0table->p0table0).copyTo(p0_tables[0]);
+    Mat<uint16_t>(424, 512, p0table->p0table1).copyTo(p0_tables[1]);
+    Mat<uint16_t>(424, 512, p0table->p0table2).copyTo(p0_tables[2]);
   }
 
-  impl_->fillTrigTable(impl_->p0_table0, impl_->trig_table0);
-  impl_->fillTrigTable(impl_->p0_table1, impl_->trig_table1);
-  impl_->fillTrigTable(impl_->p0_table2, impl_->trig_table2);
+  impl_->flushPipeline();
+  impl_->loadTrigTable(p0_tables);
+}
+
+bool CpuDepthPacketProcessor::supportsBinning() const
+{
+  return true;
+}
+
+size_t CpuDepthPacketProcessor::getFrameHeapAllocations() const
+{
+  return atomicLoad(impl_->frame_heap_allocations);
 }
 
 void CpuDepthPacketProcessor::loadXZTables(const float *xtable, const float *ztable)
 {
+  impl_->flushPipeline();
+
   impl_->x_table.create(424, 512);
   std::copy(xtable, xtable + TABLE_SIZE, impl_->x_table.ptr(0,0));
 
   impl_->z_table.create(424, 512);
   std::copy(ztable, ztable + TABLE_SIZE, impl_->z_table.ptr(0,0));
+
+  impl_->binned_x_table.create(212, 256);
+  impl_->binned_z_table.create(212, 256);
+  binXZTables(xtable, ztable, impl_->binned_x_table.ptr(0,0), impl_->binned_z_table.ptr(0,0));
 }
 
 void CpuDepthPacketProcessor::loadLookupTable(const short *lut)
 {
+  impl_->flushPipeline();
   std::copy(lut, lut + LUT_SIZE, impl_->lut11to16);
 }
 
@@ -905,99 +2874,61 @@ void CpuDepthPacketProcessor::loadLookupTable(const short *lut)
  */
 void CpuDepthPacketProcessor::process(const DepthPacket &packet)
 {
-  if(listener_ == 0) return;
-
-  impl_->startTiming();
-
-  impl_->ir_frame->timestamp = packet.timestamp;
-  impl_->depth_frame->timestamp = packet.timestamp;
-  impl_->ir_frame->sequence = packet.sequence;
-  impl_->depth_frame->sequence = packet.sequence;
-
-  Mat<Vec<float, 9> >
-      m(424, 512),
-      m_filtered(424, 512)
-  ;
-  Mat<unsigned char> m_max_edge_test(424, 512);
-
-  float *m_ptr = (m.ptr(0, 0)->val);
-
-  for(int y = 0; y < 424; ++y)
-    for(int x = 0; x < 512; ++x, m_ptr += 9)
-    {
-      impl_->processPixelStage1(x, y, packet.buffer, m_ptr + 0, m_ptr + 3, m_ptr + 6);
-    }
+  impl_->applyPendingConfiguration();
 
-  // bilateral filtering
-  if(impl_->enable_bilateral_filter)
-  {
-    float *m_filtered_ptr = (m_filtered.ptr(0, 0)->val);
-    unsigned char *m_max_edge_test_ptr = m_max_edge_test.ptr(0, 0);
+  if(listener_ == 0) return;
 
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_filtered_ptr += 9, ++m_max_edge_test_ptr)
-      {
-        bool max_edge_test_val = true;
-        impl_->filterPixelStage1(x, y, m, m_filtered_ptr, max_edge_test_val);
-        *m_max_edge_test_ptr = max_edge_test_val ? 1 : 0;
-      }
+  if(!listener_->wantsFrameType(Frame::Ir) && !listener_->wantsFrameType(Frame::Depth) && !listener_->wantsFrameType(Frame::Confidence)) return;
 
-    m_ptr = (m_filtered.ptr(0, 0)->val);
-  }
-  else
+  if(impl_->trig_table == 0)
   {
-    m_ptr = (m.ptr(0, 0)->val);
+    LOG_ERROR << "P0 tables not loaded";
+    return;
   }
 
-  Mat<float> out_ir(424, 512, impl_->ir_frame->data), out_depth(424, 512, impl_->depth_frame->data);
-
-  if(impl_->enable_edge_filter)
+  if(impl_->pipeline != 0)
   {
-    Mat<Vec<float, 3> > depth_ir_sum(424, 512);
-    Vec<float, 3> *depth_ir_sum_ptr = depth_ir_sum.ptr(0, 0);
-    unsigned char *m_max_edge_test_ptr = m_max_edge_test.ptr(0, 0);
-
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_ptr += 9, ++m_max_edge_test_ptr, ++depth_ir_sum_ptr)
-      {
-        float raw_depth, ir_sum;
+    impl_->startTiming();
+    impl_->submitFrame(packet, listener_);
+    impl_->stopTiming(LOG_INFO);
+    return;
+  }
 
-        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr(423 - y, x), &raw_depth, &ir_sum);
+  impl_->startTiming();
 
-        depth_ir_sum_ptr->val[0] = raw_depth;
-        depth_ir_sum_ptr->val[1] = *m_max_edge_test_ptr == 1 ? raw_depth : 0;
-        depth_ir_sum_ptr->val[2] = ir_sum;
-      }
+  impl_->setOutputFormats(listener_);
+  impl_->ir_frame->timestamp = packet.timestamp;
+  impl_->depth_frame->timestamp = packet.timestamp;
+  impl_->ir_frame->sequence = packet.sequence;
+  impl_->depth_frame->sequence = packet.sequence;
+  impl_->confidence_frame->timestamp = packet.timestamp;
+  impl_->confidence_frame->sequence = packet.sequence;
 
-    m_max_edge_test_ptr = m_max_edge_test.ptr(0, 0);
+  impl_->processFrame(packet.buffer);
 
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, ++m_max_edge_test_ptr)
-      {
-        impl_->filterPixelStage2(x, y, depth_ir_sum, *m_max_edge_test_ptr == 1, out_depth.ptr(423 - y, x));
-      }
-  }
-  else
+  const size_t heap_allocations = getFrameHeapAllocations();
+  if(heap_allocations != 0)
   {
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_ptr += 9)
-      {
-        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr(423 - y, x), out_depth.ptr(423 - y, x), 0);
-      }
+    LOG_WARNING << heap_allocations << " scratch heap allocations while processing a frame";
   }
 
   impl_->stopTiming(LOG_INFO);
 
   if (listener_ != 0 ){
-    if(listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
+    if(impl_->output_ir && listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
     {
       impl_->newIrFrame();
     }
 
-    if(listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
+    if(impl_->output_depth && listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
     {
       impl_->newDepthFrame();
     }
+
+    if(impl_->output_confidence && listener_->onNewFrame(Frame::Confidence, impl_->confidence_frame))
+    {
+      impl_->newConfidenceFrame();
+    }
   }
 
 }
@@ -79,6 +79,23 @@ DepthPacketProcessor::Parameters::Parameters()
   max_depth = 4500.0f;
 }
 
+DepthPacketProcessor::DecodeTable::DecodeTable()
+{
+  // 352 words = 512 * 11 / 16
+  sub_image_words = 352 * 424;
+
+  for(int y = 0; y < 424; ++y)
+    row_offset[y] = 352 * (y < 212 ? y + 212 : 423 - y);
+
+  // sample j of a row holds column 4 * (j % 128) + j / 128
+  for(int x = 0; x < 512; ++x)
+    column_bit[x] = 11 * ((x >> 2) + ((x & 3) << 7));
+
+  // the first and the last column are not valid
+  column_bit[0] = INVALID_COLUMN;
+  column_bit[511] = INVALID_COLUMN;
+}
+
 DepthPacketProcessor::DepthPacketProcessor() :
     listener_(0)
 {
@@ -93,9 +110,43 @@ void DepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketProce
   config_ = config;
 }
 
+bool DepthPacketProcessor::supportsBinning() const
+{
+  return false;
+}
+
+size_t DepthPacketProcessor::getFrameHeapAllocations() const
+{
+  return 0;
+}
+
 void DepthPacketProcessor::setFrameListener(libfreenect2::FrameListener *listener)
 {
   listener_ = listener;
 }
 
+void DepthPacketProcessor::binXZTables(const float *xtable, const float *ztable, float *binned_xtable, float *binned_ztable)
+{
+  for(int y = 0; y < 212; ++y)
+  {
+    for(int x = 0; x < 256; ++x, ++binned_xtable, ++binned_ztable)
+    {
+      const int i = 2 * y * 512 + 2 * x;
+      const int pixels[4] = {i, i + 1, i + 512, i + 513};
+      float x_sum = 0.0f, z_sum = 0.0f;
+      bool valid = true;
+
+      for(int j = 0; j < 4; ++j)
+      {
+        x_sum += xtable[pixels[j]];
+        z_sum += ztable[pixels[j]];
+        valid = valid && ztable[pixels[j]] > 0.0f;
+      }
+
+      *binned_xtable = 0.25f * x_sum;
+      *binned_ztable = valid ? 0.25f * z_sum : 0.0f;
+    }
+  }
+}
+
 } /* namespace libfreenect2 */
@@ -37,17 +37,24 @@ DepthPacketStreamParser::DepthPacketStreamParser() :
     processor_(noopProcessor<DepthPacket>()),
     processed_packets_(-1),
     current_sequence_(0),
-    current_subsequence_(0)
+    current_subsequence_(0),
+    decimation_(1),
+    skip_sequence_(false),
+    skip_subpacket_(false),
+    buffer_full_(false),
+    next_subsequence_(0),
+    direct_subsequence_(0)
 {
   size_t single_image = 512*424*11/8;
 
-  buffer_.allocate((single_image) * 10);
-  buffer_.front().length = buffer_.front().capacity;
-  buffer_.back().length = buffer_.back().capacity;
+  setBufferCount(2);
 
   work_buffer_.data = new unsigned char[single_image];
   work_buffer_.capacity = single_image;
   work_buffer_.length = 0;
+  work_buffer_.ring = 0;
+
+  memset(&statistics_, 0, sizeof(statistics_));
 }
 
 DepthPacketStreamParser::~DepthPacketStreamParser()
@@ -60,6 +67,40 @@ void DepthPacketStreamParser::setPacketProcessor(libfreenect2::BaseDepthPacketPr
   processor_ = (processor != 0) ? processor : noopProcessor<DepthPacket>();
 }
 
+void DepthPacketStreamParser::setBufferCount(size_t count)
+{
+  size_t single_image = 512*424*11/8;
+
+  buffer_.allocate((single_image) * 10, count);
+  buffer_.front().length = buffer_.front().capacity;
+  buffer_full_ = false;
+
+  current_subsequence_ = 0;
+  next_subsequence_ = 0;
+}
+
+/**
+ * Get the statistics of the stream, can be called from any thread.
+ * @return Copy of the counters.
+ */
+Freenect2Device::StreamStatistics DepthPacketStreamParser::getStatistics() const
+{
+  Freenect2Device::StreamStatistics statistics;
+
+  // all counters are uint32_t, each one is read atomically
+  const uint32_t *src = reinterpret_cast<const uint32_t *>(&statistics_);
+  uint32_t *dst = reinterpret_cast<uint32_t *>(&statistics);
+  for(size_t i = 0; i < sizeof(statistics) / sizeof(uint32_t); ++i)
+    dst[i] = atomicLoad(src[i]);
+
+  return statistics;
+}
+
+void DepthPacketStreamParser::setDecimation(unsigned int decimation)
+{
+  decimation_ = (decimation > 1) ? decimation : 1;
+}
+
 void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_length)
 {
   Buffer &wb = work_buffer_;
@@ -68,12 +109,29 @@ void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_le
   {
     //synchronize to subpacket boundary
     wb.length = 0;
+    next_subsequence_ = 0;
   }
   else
   {
     DepthSubPacketFooter *footer = 0;
     bool footer_found = false;
 
+    if(wb.length == 0)
+    {
+      // subpackets arrive in order, so until the last subpacket of a skipped
+      // sequence is seen, the incoming data belongs to it and is not copied
+      skip_subpacket_ = skip_sequence_ && (current_subsequence_ & 0x200) == 0;
+
+      // the first subpacket of a sequence goes to the work buffer because the
+      // front buffer is only handed over once its footer is seen, the others are
+      // written to their expected slot in the front buffer right away. Only
+      // empty slots are used, so the current sequence cannot complete before
+      // a mispredicted subpacket is moved to its own slot.
+      direct_subsequence_ = next_subsequence_;
+      if(skip_subpacket_ || (current_subsequence_ & (1u << next_subsequence_)) != 0)
+        direct_subsequence_ = 0;
+    }
+
     if(wb.length + in_length == wb.capacity + sizeof(DepthSubPacketFooter))
     {
       in_length -= sizeof(DepthSubPacketFooter);
@@ -84,37 +142,88 @@ void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_le
     if(wb.length + in_length > wb.capacity)
     {
       LOG_DEBUG << "subpacket too large";
+      atomicAdd(statistics_.oversized, 1);
       wb.length = 0;
+      next_subsequence_ = 0;
       return;
     }
 
-    memcpy(wb.data + wb.length, buffer, in_length);
+    if(!skip_subpacket_)
+    {
+      unsigned char *dst = (direct_subsequence_ != 0) ? buffer_.front().data + direct_subsequence_ * wb.capacity : wb.data;
+      memcpy(dst + wb.length, buffer, in_length);
+    }
     wb.length += in_length;
 
     if(footer_found)
     {
+      next_subsequence_ = 0;
+
       if(footer->length != wb.length)
       {
         LOG_DEBUG << "image data too short!";
+        atomicAdd(statistics_.invalid, 1);
       }
       else
       {
         if(current_sequence_ != footer->sequence)
         {
+          if(current_subsequence_ != 0)
+          {
+            atomicAdd(statistics_.received, 1);
+
+            if(footer->sequence != current_sequence_ + 1)
+            {
+              atomicAdd(statistics_.sequence_gaps, 1);
+              // a sequence going backwards is a resync, nothing was lost
+              if(footer->sequence > current_sequence_)
+                atomicAdd(statistics_.lost, footer->sequence - current_sequence_ - 1);
+            }
+          }
+
           if(current_subsequence_ == 0x3ff)
           {
-            if(processor_->ready())
+            bool handled = false;
+
+            if(skip_sequence_ && buffer_full_)
+            {
+              LOG_DEBUG << "dropping depth packet, no free buffer";
+              atomicAdd(statistics_.dropped, 1);
+            }
+            else if(skip_sequence_)
+            {
+              atomicAdd(statistics_.decimated, 1);
+              handled = true;
+            }
+            else if(processor_->ready())
             {
-              buffer_.swap();
+              Buffer &bb = buffer_.front();
 
               DepthPacket packet;
               packet.sequence = current_sequence_;
               packet.timestamp = footer->timestamp;
-              packet.buffer = buffer_.back().data;
-              packet.buffer_length = buffer_.back().length;
+              packet.buffer = bb.data;
+              packet.buffer_length = bb.length;
+              packet.memory = &bb;
 
               processor_->process(packet);
+              atomicAdd(statistics_.assembled, 1);
+              handled = true;
 
+              // continue in a free buffer, the processor releases this one
+              if(buffer_.next())
+                buffer_.front().length = buffer_.front().capacity;
+              else
+                buffer_full_ = true;
+            }
+            else
+            {
+              LOG_DEBUG << "skipping depth packet";
+              atomicAdd(statistics_.busy, 1);
+            }
+
+            if(handled)
+            {
               processed_packets_++;
               if (processed_packets_ == 0)
                 processed_packets_ = current_sequence_;
@@ -126,32 +235,62 @@ void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_le
                 processed_packets_ = current_sequence_;
               }
             }
-            else
-            {
-              LOG_DEBUG << "skipping depth packet";
-            }
           }
           else
           {
             LOG_DEBUG << "not all subsequences received " << current_subsequence_;
+
+            if(current_subsequence_ != 0)
+            {
+              atomicAdd(statistics_.incomplete, 1);
+              atomicStore(statistics_.incomplete_mask, current_subsequence_);
+            }
+          }
+
+          // the front buffer is still held by the processor, retry at each
+          // sequence so a sequence is never assembled into a handed over buffer
+          if(buffer_full_ && buffer_.next())
+          {
+            buffer_.front().length = buffer_.front().capacity;
+            buffer_full_ = false;
           }
 
           current_sequence_ = footer->sequence;
           current_subsequence_ = 0;
+          skip_sequence_ = buffer_full_ || (decimation_ > 1 && (current_sequence_ % decimation_) != 0);
         }
 
         Buffer &fb = buffer_.front();
 
-        // set the bit corresponding to the subsequence number to 1
-        current_subsequence_ |= 1 << footer->subsequence;
-
-        if(footer->subsequence * footer->length > fb.length)
+        if(skip_subpacket_ && !skip_sequence_)
+        {
+          // the previous sequence lost its last subpacket and this one was not copied
+          LOG_DEBUG << "subsequence " << footer->subsequence << " dropped after a skipped sequence";
+        }
+        else if(skip_sequence_)
+        {
+          // decimated and dropped sequences are only tracked, not assembled
+          current_subsequence_ |= 1 << footer->subsequence;
+        }
+        else if((footer->subsequence + 1) * footer->length > fb.length)
         {
           LOG_DEBUG << "front buffer too short! subsequence number is " << footer->subsequence;
         }
         else
         {
-          memcpy(fb.data + (footer->subsequence * footer->length), wb.data + (wb.length - footer->length), footer->length);
+          unsigned char *slot = fb.data + (footer->subsequence * footer->length);
+
+          // a subpacket written to a mispredicted slot is moved to its own
+          if(direct_subsequence_ == 0)
+            memcpy(slot, wb.data, footer->length);
+          else if(direct_subsequence_ != footer->subsequence)
+            memcpy(slot, fb.data + (direct_subsequence_ * footer->length), footer->length);
+
+          // set the bit corresponding to the subsequence number to 1
+          current_subsequence_ |= 1 << footer->subsequence;
+
+          if(footer->subsequence < 9)
+            next_subsequence_ = footer->subsequence + 1;
         }
       }
 
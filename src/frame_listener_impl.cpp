@@ -34,6 +34,16 @@ namespace libfreenect2
 
 FrameListener::~FrameListener() {}
 
+Frame::Format FrameListener::getFrameFormat(Frame::Type type) const
+{
+  return type == Frame::Color ? Frame::BGRX : Frame::Float;
+}
+
+bool FrameListener::wantsFrameType(Frame::Type type) const
+{
+  return type != Frame::Confidence;
+}
+
 /** Implementation class for synchronizing different types of frames. */
 class SyncMultiFrameListenerImpl
 {
@@ -41,6 +51,7 @@ public:
   libfreenect2::mutex mutex_;
   libfreenect2::condition_variable condition_;
   FrameMap next_frame_;
+  std::map<Frame::Type, Frame::Format> frame_formats_;
 
   const unsigned int subscribed_frame_types_;
   unsigned int ready_frame_types_;
@@ -114,6 +125,27 @@ void SyncMultiFrameListener::waitForNewFrame(FrameMap &frame)
   impl_->ready_frame_types_ = 0;
 }
 
+void SyncMultiFrameListener::setFrameFormat(Frame::Type type, Frame::Format format)
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  impl_->frame_formats_[type] = format;
+}
+
+Frame::Format SyncMultiFrameListener::getFrameFormat(Frame::Type type) const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  std::map<Frame::Type, Frame::Format>::const_iterator it = impl_->frame_formats_.find(type);
+
+  return it != impl_->frame_formats_.end() ? it->second : FrameListener::getFrameFormat(type);
+}
+
+bool SyncMultiFrameListener::wantsFrameType(Frame::Type type) const
+{
+  return (impl_->subscribed_frame_types_ & type) != 0;
+}
+
 void SyncMultiFrameListener::release(FrameMap &frame)
 {
   for(FrameMap::iterator it = frame.begin(); it != frame.end(); ++it)
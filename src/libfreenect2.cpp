@@ -40,6 +40,8 @@
 #include <libfreenect2/usb/transfer_pool.h>
 #include <libfreenect2/depth_packet_processor.h>
 #include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/depth_packet_stream_parser.h>
+#include <libfreenect2/rgb_packet_stream_parser.h>
 #include <libfreenect2/protocol/usb_control.h>
 #include <libfreenect2/protocol/command.h>
 #include <libfreenect2/protocol/response.h>
@@ -238,6 +240,7 @@ private:
   std::string serial_, firmware_;
   Freenect2Device::IrCameraParams ir_camera_params_;
   Freenect2Device::ColorCameraParams rgb_camera_params_;
+  Freenect2Device::Config config_;
 public:
   Freenect2DeviceImpl(Freenect2Impl *context, const PacketPipeline *pipeline, libusb_device *usb_device, libusb_device_handle *usb_device_handle, const std::string &serial);
   virtual ~Freenect2DeviceImpl();
@@ -249,6 +252,10 @@ public:
 
   virtual Freenect2Device::ColorCameraParams getColorCameraParams();
   virtual Freenect2Device::IrCameraParams getIrCameraParams();
+  virtual Freenect2Device::IrCameraParams getScaledIrCameraParams();
+  virtual Freenect2Device::ColorCameraParams getScaledColorCameraParams();
+  virtual Freenect2Device::StreamStatistics getColorStreamStatistics();
+  virtual Freenect2Device::StreamStatistics getIrStreamStatistics();
   virtual void setColorCameraParams(const Freenect2Device::ColorCameraParams &params);
   virtual void setIrCameraParams(const Freenect2Device::IrCameraParams &params);
   virtual void setConfiguration(const Freenect2Device::Config &config);
@@ -590,6 +597,52 @@ Freenect2Device::IrCameraParams Freenect2DeviceImpl::getIrCameraParams()
   return ir_camera_params_;
 }
 
+Freenect2Device::IrCameraParams Freenect2DeviceImpl::getScaledIrCameraParams()
+{
+  IrCameraParams params = ir_camera_params_;
+
+  // only set by setConfiguration() if the depth processor bins
+  if(config_.EnableBinning)
+  {
+    // pixel x covers [x, x + 1), so a binned pixel covers [2x, 2x + 2)
+    params.fx *= 0.5f;
+    params.fy *= 0.5f;
+    params.cx *= 0.5f;
+    params.cy *= 0.5f;
+  }
+
+  return params;
+}
+
+Freenect2Device::ColorCameraParams Freenect2DeviceImpl::getScaledColorCameraParams()
+{
+  ColorCameraParams params = rgb_camera_params_;
+
+  // validated by setConfiguration()
+  if(config_.ColorDownscale > 1)
+  {
+    // pixel centres are at integer coordinates, a downscaled pixel covers
+    // ColorDownscale full size pixels, so its centre is at their middle
+    const float scale = 1.0f / config_.ColorDownscale;
+    params.fx *= scale;
+    params.fy *= scale;
+    params.cx = (params.cx + 0.5f) * scale - 0.5f;
+    params.cy = (params.cy + 0.5f) * scale - 0.5f;
+  }
+
+  return params;
+}
+
+Freenect2Device::StreamStatistics Freenect2DeviceImpl::getColorStreamStatistics()
+{
+  return pipeline_->getRgbPacketStreamParser()->getStatistics();
+}
+
+Freenect2Device::StreamStatistics Freenect2DeviceImpl::getIrStreamStatistics()
+{
+  return pipeline_->getDepthPacketStreamParser()->getStatistics();
+}
+
 void Freenect2DeviceImpl::setColorCameraParams(const Freenect2Device::ColorCameraParams &params)
 {
   rgb_camera_params_ = params;
@@ -611,13 +664,54 @@ Freenect2Device::Config::Config() :
   MinDepth(0.5f),
   MaxDepth(4.5f),
   EnableBilateralFilter(true),
-  EnableEdgeAwareFilter(true) {}
+  EnableEdgeAwareFilter(true),
+  EnableFastMath(false),
+  RoiX(0),
+  RoiY(0),
+  RoiWidth(0),
+  RoiHeight(0),
+  EnableBinning(false),
+  EnableTemporalFilter(false),
+  TemporalFilterAlpha(0.4f),
+  TemporalFilterThreshold(0.03f),
+  DepthDecimation(1),
+  PacketBuffers(2),
+  DropOldestPacket(false),
+  ColorDownscale(1),
+  ColorRoiX(0),
+  ColorRoiY(0),
+  ColorRoiWidth(0),
+  ColorRoiHeight(0) {}
 
 void Freenect2DeviceImpl::setConfiguration(const Freenect2Device::Config &config)
 {
+  config_ = config;
+
+  // TurboJPEG only scales by 1/2, 1/4 and 1/8, the camera parameters must match the frames
+  const int scale = config_.ColorDownscale;
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+  {
+    LOG_WARNING << "unsupported color downscale " << scale << ", decoding at full size";
+    config_.ColorDownscale = 1;
+  }
+
   DepthPacketProcessor *proc = pipeline_->getDepthPacketProcessor();
+
+  // getScaledIrCameraParams() must describe the frames the depth processor outputs
+  if (config_.EnableBinning && (proc == 0 || !proc->supportsBinning()))
+  {
+    LOG_WARNING << "binning is not supported by the depth processor of this pipeline, disabled";
+    config_.EnableBinning = false;
+  }
+
   if (proc != 0)
-    proc->setConfiguration(config);
+    proc->setConfiguration(config_);
+  DepthPacketStreamParser *parser = pipeline_->getDepthPacketStreamParser();
+  if (parser != 0)
+    parser->setDecimation(config_.DepthDecimation > 1 ? config_.DepthDecimation : 1);
+  RgbPacketProcessor *rgb_proc = pipeline_->getRgbPacketProcessor();
+  if (rgb_proc != 0)
+    rgb_proc->setConfiguration(config_);
 }
 
 void Freenect2DeviceImpl::setColorFrameListener(libfreenect2::FrameListener* rgb_frame_listener)
@@ -790,6 +884,8 @@ bool Freenect2DeviceImpl::start()
   command_tx_.execute(ReadData0x26Command(nextCommandSeq()), result);
   command_tx_.execute(ReadData0x26Command(nextCommandSeq()), result);
 */
+  pipeline_->setPacketBuffers(config_.PacketBuffers, config_.DropOldestPacket);
+
   LOG_INFO << "enabling usb transfer submission...";
   rgb_transfer_pool_.enableSubmission();
   ir_transfer_pool_.enableSubmission();
@@ -28,19 +28,20 @@
  * Process pixel stage 1
  ******************************************************************************/
 
-float decodePixelMeasurement(global const ushort *data, global const short *lut11to16, const uint sub, const uint x, const uint y)
+float decodePixelMeasurement(global const ushort *data, global const short *lut11to16, const uint sub, const uint row_offset, const uint column_bit)
 {
-  uint row_idx = (424 * sub + (y < 212 ? y + 212 : 423 - y)) * 352;
-  uint idx = (((x >> 2) + ((x << 7) & BFI_BITMASK)) * 11) & (uint)0xffffffff;
+  if(column_bit == INVALID_COLUMN)
+  {
+    return (float)lut11to16[0];
+  }
 
-  uint col_idx = idx >> 4;
-  uint upper_bytes = idx & 15;
-  uint lower_bytes = 16 - upper_bytes;
+  uint data_idx0 = sub * SUB_IMAGE_WORDS + row_offset + (column_bit >> 4);
+  uint data_idx1 = data_idx0 + 1;
 
-  uint data_idx0 = row_idx + col_idx;
-  uint data_idx1 = row_idx + col_idx + 1;
+  uint upper_bytes = column_bit & 15;
+  uint lower_bytes = 16 - upper_bytes;
 
-  return (float)lut11to16[(x < 1 || 510 < x || col_idx > 352) ? 0 : ((data[data_idx0] >> upper_bytes) | (data[data_idx1] << lower_bytes)) & 2047];
+  return (float)lut11to16[((data[data_idx0] >> upper_bytes) | (data[data_idx1] << lower_bytes)) & 2047];
 }
 
 float2 processMeasurementTriple(const float ab_multiplier_per_frq, const float p0, const float3 v, int *invalid)
@@ -55,7 +56,8 @@ float2 processMeasurementTriple(const float ab_multiplier_per_frq, const float p
 }
 
 void kernel processPixelStage1(global const short *lut11to16, global const float *z_table, global const float3 *p0_table, global const ushort *data,
-                               global float3 *a_out, global float3 *b_out, global float3 *n_out, global float *ir_out)
+                               global float3 *a_out, global float3 *b_out, global float3 *n_out, global float *ir_out,
+                               global const uint *row_offset_table, global const uint *column_bit_table)
 {
   const uint i = get_global_id(0);
 
@@ -63,6 +65,8 @@ void kernel processPixelStage1(global const short *lut11to16, global const float
   const uint y = i / 512;
 
   const uint y_in = (423 - y);
+  const uint row_offset = row_offset_table[y_in];
+  const uint column_bit = column_bit_table[x];
 
   const float zmultiplier = z_table[i];
   int valid = (int)(0.0f < zmultiplier);
@@ -72,19 +76,19 @@ void kernel processPixelStage1(global const short *lut11to16, global const float
   int3 invalid_pixel = (int3)((int)(!valid));
   const float3 p0 = p0_table[i];
 
-  const float3 v0 = (float3)(decodePixelMeasurement(data, lut11to16, 0, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 1, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 2, x, y_in));
+  const float3 v0 = (float3)(decodePixelMeasurement(data, lut11to16, 0, row_offset, column_bit),
+                             decodePixelMeasurement(data, lut11to16, 1, row_offset, column_bit),
+                             decodePixelMeasurement(data, lut11to16, 2, row_offset, column_bit));
   const float2 ab0 = processMeasurementTriple(AB_MULTIPLIER_PER_FRQ0, p0.x, v0, &saturatedX);
 
-  const float3 v1 = (float3)(decodePixelMeasurement(data, lut11to16, 3, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 4, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 5, x, y_in));
+  const float3 v1 = (float3)(decodePixelMeasurement(data, lut11to16, 3, row_offset, column_bit),
+                             decodePixelMeasurement(data, lut11to16, 4, row_offset, column_bit),
+                             decodePixelMeasurement(data, lut11to16, 5, row_offset, column_bit));
   const float2 ab1 = processMeasurementTriple(AB_MULTIPLIER_PER_FRQ1, p0.y, v1, &saturatedY);
 
-  const float3 v2 = (float3)(decodePixelMeasurement(data, lut11to16, 6, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 7, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 8, x, y_in));
+  const float3 v2 = (float3)(decodePixelMeasurement(data, lut11to16, 6, row_offset, column_bit),
+                             decodePixelMeasurement(data, lut11to16, 7, row_offset, column_bit),
+                             decodePixelMeasurement(data, lut11to16, 8, row_offset, column_bit));
   const float2 ab2 = processMeasurementTriple(AB_MULTIPLIER_PER_FRQ2, p0.z, v2, &saturatedZ);
 
   float3 a = select((float3)(ab0.x, ab1.x, ab2.x), (float3)(0.0f), invalid_pixel);
@@ -101,6 +105,31 @@ void kernel processPixelStage1(global const short *lut11to16, global const float
   ir_out[i] = min(dot(select(n, (float3)(65535.0f), saturated), (float3)(0.333333333f  * AB_MULTIPLIER * AB_OUTPUT_MULTIPLIER)), 65535.0f);
 }
 
+/*******************************************************************************
+ * Bin pixel stage 1
+ ******************************************************************************/
+void kernel binPixelStage1(global const float3 *a_in, global const float3 *b_in, global const float *ir_in,
+                           global float3 *a_out, global float3 *b_out, global float3 *n_out, global float *ir_out)
+{
+  const uint i = get_global_id(0);
+
+  const uint x = i % WIDTH;
+  const uint y = i / WIDTH;
+
+  const uint i00 = 2 * y * 512 + 2 * x;
+  const uint i01 = i00 + 1;
+  const uint i10 = i00 + 512;
+  const uint i11 = i10 + 1;
+
+  const float3 a = (a_in[i00] + a_in[i01] + a_in[i10] + a_in[i11]) * 0.25f;
+  const float3 b = (b_in[i00] + b_in[i01] + b_in[i10] + b_in[i11]) * 0.25f;
+
+  a_out[i] = a;
+  b_out[i] = b;
+  n_out[i] = sqrt(a * a + b * b);
+  ir_out[i] = (ir_in[i00] + ir_in[i01] + ir_in[i10] + ir_in[i11]) * 0.25f;
+}
+
 /*******************************************************************************
  * Filter pixel stage 1
  ******************************************************************************/
@@ -109,15 +138,15 @@ void kernel filterPixelStage1(global const float3 *a, global const float3 *b, gl
 {
   const uint i = get_global_id(0);
 
-  const uint x = i % 512;
-  const uint y = i / 512;
+  const uint x = i % WIDTH;
+  const uint y = i / WIDTH;
 
   const float3 self_a = a[i];
   const float3 self_b = b[i];
 
   const float gaussian[9] = {GAUSSIAN_KERNEL_0, GAUSSIAN_KERNEL_1, GAUSSIAN_KERNEL_2, GAUSSIAN_KERNEL_3, GAUSSIAN_KERNEL_4, GAUSSIAN_KERNEL_5, GAUSSIAN_KERNEL_6, GAUSSIAN_KERNEL_7, GAUSSIAN_KERNEL_8};
 
-  if(x < 1 || y < 1 || x > 510 || y > 422)
+  if(x < 1 || y < 1 || x > WIDTH - 2 || y > HEIGHT - 2)
   {
     a_out[i] = self_a;
     b_out[i] = self_b;
@@ -144,7 +173,7 @@ void kernel filterPixelStage1(global const float3 *a, global const float3 *b, gl
 
     for(int yi = -1, j = 0; yi < 2; ++yi)
     {
-      uint i_other = (y + yi) * 512 + x - 1;
+      uint i_other = (y + yi) * WIDTH + x - 1;
 
       for(int xi = -1; xi < 2; ++xi, ++j, ++i_other)
       {
@@ -178,9 +207,10 @@ void kernel filterPixelStage1(global const float3 *a, global const float3 *b, gl
  * Process pixel stage 2
  ******************************************************************************/
 void kernel processPixelStage2(global const float3 *a_in, global const float3 *b_in, global const float *x_table, global const float *z_table,
-                               global float *depth, global float *ir_sums)
+                               global float *depth, global float *ir_sums, global uchar *confidence)
 {
   const uint i = get_global_id(0);
+  uchar flags = 0;
   float3 a = a_in[i];
   float3 b = b_in[i];
 
@@ -258,10 +288,19 @@ void kernel processPixelStage2(global const float3 *a_in, global const float3 *b
 
     float t11 = t10 * mask2;
 
+    if(mask == 0.0f || mask2 == 0.0f)
+    {
+      flags |= CONFIDENCE_AMBIGUOUS;
+    }
+
     float mask3 = MAX_DEALIAS_CONFIDENCE * MAX_DEALIAS_CONFIDENCE >= norm ? 1.0f : 0.0f;
     t10 *= mask3;
     phase_final = true/*(modeMask & 2) != 0*/ ? t11 : t10;
   }
+  else
+  {
+    flags |= CONFIDENCE_LOW_AMPLITUDE;
+  }
 
   float zmultiplier = z_table[i];
   float xmultiplier = x_table[i];
@@ -281,17 +320,25 @@ void kernel processPixelStage2(global const float3 *a_in, global const float3 *b
   float d = cond1 ? depth_fit : depth_linear; // r1.y -> later r2.z
   depth[i] = d;
   ir_sums[i] = ir_sum;
+
+  if(0.0f < d)
+  {
+    flags |= CONFIDENCE_DEPTH_VALID;
+    flags |= d < MIN_DEPTH || d > MAX_DEPTH ? CONFIDENCE_OUT_OF_RANGE : 0;
+  }
+  confidence[i] = flags;
 }
 
 /*******************************************************************************
  * Filter pixel stage 2
  ******************************************************************************/
-void kernel filterPixelStage2(global const float *depth, global const float *ir_sums, global const uchar *max_edge_test, global float *filtered)
+void kernel filterPixelStage2(global const float *depth, global const float *ir_sums, global const uchar *max_edge_test, global float *filtered,
+                              global uchar *confidence)
 {
   const uint i = get_global_id(0);
 
-  const uint x = i % 512;
-  const uint y = i / 512;
+  const uint x = i % WIDTH;
+  const uint y = i / WIDTH;
 
   const float raw_depth = depth[i];
   const float ir_sum = ir_sums[i];
@@ -299,7 +346,7 @@ void kernel filterPixelStage2(global const float *depth, global const float *ir_
 
   if(raw_depth >= MIN_DEPTH && raw_depth <= MAX_DEPTH)
   {
-    if(x < 1 || y < 1 || x > 510 || y > 422)
+    if(x < 1 || y < 1 || x > WIDTH - 2 || y > HEIGHT - 2)
     {
       filtered[i] = raw_depth;
     }
@@ -312,7 +359,7 @@ void kernel filterPixelStage2(global const float *depth, global const float *ir_
 
       for(int yi = -1; yi < 2; ++yi)
       {
-        uint i_other = (y + yi) * 512 + x - 1;
+        uint i_other = (y + yi) * WIDTH + x - 1;
 
         for(int xi = -1; xi < 2; ++xi, ++i_other)
         {
@@ -377,4 +424,54 @@ void kernel filterPixelStage2(global const float *depth, global const float *ir_
   {
     filtered[i] = 0.0f;
   }
+
+  uchar flags = confidence[i];
+
+  if(!(0.0f < filtered[i]))
+  {
+    flags &= ~CONFIDENCE_DEPTH_VALID;
+
+    // the filter only removes depth in range for failing an edge test, stage 2 flags the other rejects
+    if(0.0f < raw_depth && (flags & CONFIDENCE_OUT_OF_RANGE) == 0)
+    {
+      flags |= CONFIDENCE_EDGE;
+    }
+  }
+  confidence[i] = flags;
+}
+
+/*******************************************************************************
+ * Temporal filter
+ ******************************************************************************/
+void kernel filterTemporal(global float *depth, global float *average)
+{
+  const uint i = get_global_id(0);
+  float d = depth[i];
+
+  if(!(d > 0.0f))
+  {
+    average[i] = 0.0f;
+    return;
+  }
+
+  const float avg = average[i];
+
+  if(avg > 0.0f && fabs(d - avg) <= TEMPORAL_THRESHOLD)
+  {
+    d = avg + TEMPORAL_ALPHA * (d - avg);
+  }
+
+  average[i] = d;
+  depth[i] = d;
+}
+
+/*******************************************************************************
+ * Convert to uint16
+ ******************************************************************************/
+void kernel convertToUInt16(global const float *in, global ushort *out)
+{
+  const uint i = get_global_id(0);
+  const float v = in[i];
+
+  out[i] = v > 0.0f ? (ushort)(min(v, 65535.0f) + 0.5f) : 0;
 }
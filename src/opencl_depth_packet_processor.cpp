@@ -78,11 +78,16 @@ public:
   cl_short lut11to16[2048];
   cl_float x_table[512 * 424];
   cl_float z_table[512 * 424];
+  cl_float binned_x_table[256 * 212];
+  cl_float binned_z_table[256 * 212];
   cl_float3 p0_table[512 * 424];
+  DepthPacketProcessor::DecodeTable decode_table;
   libfreenect2::DepthPacketProcessor::Config config;
   DepthPacketProcessor::Parameters params;
 
-  Frame *ir_frame, *depth_frame;
+  Frame *ir_frame, *depth_frame, *confidence_frame;
+  Frame::Format ir_format, depth_format; ///< Float or UInt16.
+  bool output_ir, output_depth, output_confidence; ///< Whether the listener wants IR, depth and confidence frames.
 
   cl::Context context;
   cl::Device device;
@@ -91,11 +96,16 @@ public:
   cl::CommandQueue queue;
 
   cl::Kernel kernel_processPixelStage1;
+  cl::Kernel kernel_binPixelStage1;
   cl::Kernel kernel_filterPixelStage1;
   cl::Kernel kernel_processPixelStage2;
   cl::Kernel kernel_filterPixelStage2;
+  cl::Kernel kernel_filterTemporal;
+  cl::Kernel kernel_convertIr;
+  cl::Kernel kernel_convertDepth;
 
   size_t image_size;
+  size_t output_size; ///< Pixels after stage 1, a quarter of #image_size if binning.
 
   // Read only buffers
   size_t buf_lut11to16_size;
@@ -103,12 +113,18 @@ public:
   size_t buf_x_table_size;
   size_t buf_z_table_size;
   size_t buf_packet_size;
+  size_t buf_row_offset_size;
+  size_t buf_column_bit_size;
 
   cl::Buffer buf_lut11to16;
   cl::Buffer buf_p0_table;
   cl::Buffer buf_x_table;
   cl::Buffer buf_z_table;
+  cl::Buffer buf_binned_x_table;
+  cl::Buffer buf_binned_z_table;
   cl::Buffer buf_packet;
+  cl::Buffer buf_row_offset;
+  cl::Buffer buf_column_bit;
 
   // Read-Write buffers
   size_t buf_a_size;
@@ -121,17 +137,26 @@ public:
   size_t buf_depth_size;
   size_t buf_ir_sum_size;
   size_t buf_filtered_size;
+  size_t buf_uint16_size;
 
   cl::Buffer buf_a;
   cl::Buffer buf_b;
   cl::Buffer buf_n;
   cl::Buffer buf_ir;
+  cl::Buffer buf_a_binned;
+  cl::Buffer buf_b_binned;
+  cl::Buffer buf_n_binned;
+  cl::Buffer buf_ir_binned;
   cl::Buffer buf_a_filtered;
   cl::Buffer buf_b_filtered;
   cl::Buffer buf_edge_test;
   cl::Buffer buf_depth;
   cl::Buffer buf_ir_sum;
   cl::Buffer buf_filtered;
+  cl::Buffer buf_ir_uint16;
+  cl::Buffer buf_depth_uint16;
+  cl::Buffer buf_temporal_depth; ///< Per-pixel average of the temporal filter.
+  cl::Buffer buf_confidence;
 
   bool deviceInitialized;
   bool programBuilt;
@@ -148,8 +173,14 @@ public:
     setenv("OCL_STRICT_CONFORMANCE", "0", 0);
 #endif
 
+    ir_format = Frame::Float;
+    depth_format = Frame::Float;
+    output_ir = true;
+    output_depth = true;
+    output_confidence = false;
     newIrFrame();
     newDepthFrame();
+    newConfidenceFrame();
 
     image_size = 512 * 424;
 
@@ -185,6 +216,7 @@ public:
   {
     delete ir_frame;
     delete depth_frame;
+    delete confidence_frame;
   }
 
   void generateOptions(std::string &options) const
@@ -192,7 +224,16 @@ public:
     std::ostringstream oss;
     oss.precision(16);
     oss << std::scientific;
-    oss << " -D BFI_BITMASK=" << "0x180";
+    oss << " -D SUB_IMAGE_WORDS=" << decode_table.sub_image_words << "u";
+    oss << " -D INVALID_COLUMN=" << DepthPacketProcessor::DecodeTable::INVALID_COLUMN << "u";
+    oss << " -D WIDTH=" << (config.EnableBinning ? 256 : 512) << "u";
+    oss << " -D HEIGHT=" << (config.EnableBinning ? 212 : 424) << "u";
+
+    oss << " -D CONFIDENCE_DEPTH_VALID=" << Frame::DepthValid;
+    oss << " -D CONFIDENCE_LOW_AMPLITUDE=" << Frame::LowAmplitude;
+    oss << " -D CONFIDENCE_AMBIGUOUS=" << Frame::Ambiguous;
+    oss << " -D CONFIDENCE_OUT_OF_RANGE=" << Frame::OutOfRange;
+    oss << " -D CONFIDENCE_EDGE=" << Frame::Edge;
 
     oss << " -D AB_MULTIPLIER=" << params.ab_multiplier << "f";
     oss << " -D AB_MULTIPLIER_PER_FRQ0=" << params.ab_multiplier_per_frq[0] << "f";
@@ -237,6 +278,14 @@ public:
 
     oss << " -D MIN_DEPTH=" << config.MinDepth * 1000.0f << "f";
     oss << " -D MAX_DEPTH=" << config.MaxDepth * 1000.0f << "f";
+
+    oss << " -D TEMPORAL_ALPHA=" << std::min(std::max(config.TemporalFilterAlpha, 0.0f), 1.0f) << "f";
+    oss << " -D TEMPORAL_THRESHOLD=" << config.TemporalFilterThreshold * 1000.0f << "f";
+
+    if(config.EnableFastMath)
+    {
+      oss << " -cl-fast-relaxed-math";
+    }
     options = oss.str();
   }
 
@@ -379,6 +428,8 @@ public:
       buf_x_table_size = image_size * sizeof(cl_float);
       buf_z_table_size = image_size * sizeof(cl_float);
       buf_packet_size = ((image_size * 11) / 16) * 10 * sizeof(cl_ushort);
+      buf_row_offset_size = 424 * sizeof(cl_uint);
+      buf_column_bit_size = 512 * sizeof(cl_uint);
 
       buf_lut11to16 = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_lut11to16_size, NULL, &err);
       CHECK_CL_ERROR(err, "cl::Buffer");
@@ -390,18 +441,24 @@ public:
       CHECK_CL_ERROR(err, "cl::Buffer");
       buf_packet = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_packet_size, NULL, &err);
       CHECK_CL_ERROR(err, "cl::Buffer");
+      buf_row_offset = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_row_offset_size, NULL, &err);
+      CHECK_CL_ERROR(err, "cl::Buffer");
+      buf_column_bit = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_column_bit_size, NULL, &err);
+      CHECK_CL_ERROR(err, "cl::Buffer");
 
       //Read-Write
       buf_a_size = image_size * sizeof(cl_float3);
       buf_b_size = image_size * sizeof(cl_float3);
       buf_n_size = image_size * sizeof(cl_float3);
       buf_ir_size = image_size * sizeof(cl_float);
-      buf_a_filtered_size = image_size * sizeof(cl_float3);
-      buf_b_filtered_size = image_size * sizeof(cl_float3);
-      buf_edge_test_size = image_size * sizeof(cl_uchar);
-      buf_depth_size = image_size * sizeof(cl_float);
-      buf_ir_sum_size = image_size * sizeof(cl_float);
-      buf_filtered_size = image_size * sizeof(cl_float);
+      output_size = config.EnableBinning ? image_size / 4 : image_size;
+      buf_a_filtered_size = output_size * sizeof(cl_float3);
+      buf_b_filtered_size = output_size * sizeof(cl_float3);
+      buf_edge_test_size = output_size * sizeof(cl_uchar);
+      buf_depth_size = output_size * sizeof(cl_float);
+      buf_ir_sum_size = output_size * sizeof(cl_float);
+      buf_filtered_size = output_size * sizeof(cl_float);
+      buf_uint16_size = output_size * sizeof(cl_ushort);
 
       buf_a = cl::Buffer(context, CL_READ_WRITE_CACHE, buf_a_size, NULL, &err);
       CHECK_CL_ERROR(err, "cl::Buffer");
@@ -423,6 +480,34 @@ public:
       CHECK_CL_ERROR(err, "cl::Buffer");
       buf_filtered = cl::Buffer(context, CL_READ_WRITE_CACHE, buf_filtered_size, NULL, &err);
       CHECK_CL_ERROR(err, "cl::Buffer");
+      buf_confidence = cl::Buffer(context, CL_READ_WRITE_CACHE, output_size * sizeof(cl_uchar), NULL, &err);
+      CHECK_CL_ERROR(err, "cl::Buffer");
+
+      if(config.EnableBinning)
+      {
+        buf_binned_x_table = cl::Buffer(context, CL_READ_ONLY_CACHE, output_size * sizeof(cl_float), NULL, &err);
+        CHECK_CL_ERROR(err, "cl::Buffer");
+        buf_binned_z_table = cl::Buffer(context, CL_READ_ONLY_CACHE, output_size * sizeof(cl_float), NULL, &err);
+        CHECK_CL_ERROR(err, "cl::Buffer");
+        buf_a_binned = cl::Buffer(context, CL_READ_WRITE_CACHE, output_size * sizeof(cl_float3), NULL, &err);
+        CHECK_CL_ERROR(err, "cl::Buffer");
+        buf_b_binned = cl::Buffer(context, CL_READ_WRITE_CACHE, output_size * sizeof(cl_float3), NULL, &err);
+        CHECK_CL_ERROR(err, "cl::Buffer");
+        buf_n_binned = cl::Buffer(context, CL_READ_WRITE_CACHE, output_size * sizeof(cl_float3), NULL, &err);
+        CHECK_CL_ERROR(err, "cl::Buffer");
+        buf_ir_binned = cl::Buffer(context, CL_READ_WRITE_CACHE, output_size * sizeof(cl_float), NULL, &err);
+        CHECK_CL_ERROR(err, "cl::Buffer");
+      }
+
+      // inputs of the stages after stage 1
+      cl::Buffer &stage1_a = config.EnableBinning ? buf_a_binned : buf_a;
+      cl::Buffer &stage1_b = config.EnableBinning ? buf_b_binned : buf_b;
+      cl::Buffer &stage1_n = config.EnableBinning ? buf_n_binned : buf_n;
+      cl::Buffer &stage1_ir = config.EnableBinning ? buf_ir_binned : buf_ir;
+      buf_ir_uint16 = cl::Buffer(context, CL_READ_WRITE_CACHE, buf_uint16_size, NULL, &err);
+      CHECK_CL_ERROR(err, "cl::Buffer");
+      buf_depth_uint16 = cl::Buffer(context, CL_READ_WRITE_CACHE, buf_uint16_size, NULL, &err);
+      CHECK_CL_ERROR(err, "cl::Buffer");
 
       kernel_processPixelStage1 = cl::Kernel(program, "processPixelStage1", &err);
       CHECK_CL_ERROR(err, "cl::Kernel");
@@ -442,14 +527,38 @@ public:
       CHECK_CL_ERROR(err, "setArg");
       err = kernel_processPixelStage1.setArg(7, buf_ir);
       CHECK_CL_ERROR(err, "setArg");
+      err = kernel_processPixelStage1.setArg(8, buf_row_offset);
+      CHECK_CL_ERROR(err, "setArg");
+      err = kernel_processPixelStage1.setArg(9, buf_column_bit);
+      CHECK_CL_ERROR(err, "setArg");
+
+      if(config.EnableBinning)
+      {
+        kernel_binPixelStage1 = cl::Kernel(program, "binPixelStage1", &err);
+        CHECK_CL_ERROR(err, "cl::Kernel");
+        err = kernel_binPixelStage1.setArg(0, buf_a);
+        CHECK_CL_ERROR(err, "setArg");
+        err = kernel_binPixelStage1.setArg(1, buf_b);
+        CHECK_CL_ERROR(err, "setArg");
+        err = kernel_binPixelStage1.setArg(2, buf_ir);
+        CHECK_CL_ERROR(err, "setArg");
+        err = kernel_binPixelStage1.setArg(3, buf_a_binned);
+        CHECK_CL_ERROR(err, "setArg");
+        err = kernel_binPixelStage1.setArg(4, buf_b_binned);
+        CHECK_CL_ERROR(err, "setArg");
+        err = kernel_binPixelStage1.setArg(5, buf_n_binned);
+        CHECK_CL_ERROR(err, "setArg");
+        err = kernel_binPixelStage1.setArg(6, buf_ir_binned);
+        CHECK_CL_ERROR(err, "setArg");
+      }
 
       kernel_filterPixelStage1 = cl::Kernel(program, "filterPixelStage1", &err);
       CHECK_CL_ERROR(err, "cl::Kernel");
-      err = kernel_filterPixelStage1.setArg(0, buf_a);
+      err = kernel_filterPixelStage1.setArg(0, stage1_a);
       CHECK_CL_ERROR(err, "setArg");
-      err = kernel_filterPixelStage1.setArg(1, buf_b);
+      err = kernel_filterPixelStage1.setArg(1, stage1_b);
       CHECK_CL_ERROR(err, "setArg");
-      err = kernel_filterPixelStage1.setArg(2, buf_n);
+      err = kernel_filterPixelStage1.setArg(2, stage1_n);
       CHECK_CL_ERROR(err, "setArg");
       err = kernel_filterPixelStage1.setArg(3, buf_a_filtered);
       CHECK_CL_ERROR(err, "setArg");
@@ -460,18 +569,20 @@ public:
 
       kernel_processPixelStage2 = cl::Kernel(program, "processPixelStage2", &err);
       CHECK_CL_ERROR(err, "cl::Kernel");
-      err = kernel_processPixelStage2.setArg(0, config.EnableBilateralFilter ? buf_a_filtered : buf_a);
+      err = kernel_processPixelStage2.setArg(0, config.EnableBilateralFilter ? buf_a_filtered : stage1_a);
       CHECK_CL_ERROR(err, "setArg");
-      err = kernel_processPixelStage2.setArg(1, config.EnableBilateralFilter ? buf_b_filtered : buf_b);
+      err = kernel_processPixelStage2.setArg(1, config.EnableBilateralFilter ? buf_b_filtered : stage1_b);
       CHECK_CL_ERROR(err, "setArg");
-      err = kernel_processPixelStage2.setArg(2, buf_x_table);
+      err = kernel_processPixelStage2.setArg(2, config.EnableBinning ? buf_binned_x_table : buf_x_table);
       CHECK_CL_ERROR(err, "setArg");
-      err = kernel_processPixelStage2.setArg(3, buf_z_table);
+      err = kernel_processPixelStage2.setArg(3, config.EnableBinning ? buf_binned_z_table : buf_z_table);
       CHECK_CL_ERROR(err, "setArg");
       err = kernel_processPixelStage2.setArg(4, buf_depth);
       CHECK_CL_ERROR(err, "setArg");
       err = kernel_processPixelStage2.setArg(5, buf_ir_sum);
       CHECK_CL_ERROR(err, "setArg");
+      err = kernel_processPixelStage2.setArg(6, buf_confidence);
+      CHECK_CL_ERROR(err, "setArg");
 
       kernel_filterPixelStage2 = cl::Kernel(program, "filterPixelStage2", &err);
       CHECK_CL_ERROR(err, "cl::Kernel");
@@ -483,8 +594,41 @@ public:
       CHECK_CL_ERROR(err, "setArg");
       err = kernel_filterPixelStage2.setArg(3, buf_filtered);
       CHECK_CL_ERROR(err, "setArg");
+      err = kernel_filterPixelStage2.setArg(4, buf_confidence);
+      CHECK_CL_ERROR(err, "setArg");
+
+      if(config.EnableTemporalFilter)
+      {
+        // the average starts over whenever the program is initialized
+        std::vector<cl_float> zeros(output_size, 0.0f);
+        buf_temporal_depth = cl::Buffer(context, CL_READ_WRITE_CACHE, output_size * sizeof(cl_float), NULL, &err);
+        CHECK_CL_ERROR(err, "cl::Buffer");
+        err = queue.enqueueWriteBuffer(buf_temporal_depth, CL_TRUE, 0, output_size * sizeof(cl_float), &zeros[0]);
+        CHECK_CL_ERROR(err, "enqueueWriteBuffer");
+
+        kernel_filterTemporal = cl::Kernel(program, "filterTemporal", &err);
+        CHECK_CL_ERROR(err, "cl::Kernel");
+        err = kernel_filterTemporal.setArg(0, config.EnableEdgeAwareFilter ? buf_filtered : buf_depth);
+        CHECK_CL_ERROR(err, "setArg");
+        err = kernel_filterTemporal.setArg(1, buf_temporal_depth);
+        CHECK_CL_ERROR(err, "setArg");
+      }
+
+      kernel_convertIr = cl::Kernel(program, "convertToUInt16", &err);
+      CHECK_CL_ERROR(err, "cl::Kernel");
+      err = kernel_convertIr.setArg(0, stage1_ir);
+      CHECK_CL_ERROR(err, "setArg");
+      err = kernel_convertIr.setArg(1, buf_ir_uint16);
+      CHECK_CL_ERROR(err, "setArg");
 
-      cl::Event event0, event1, event2, event3;
+      kernel_convertDepth = cl::Kernel(program, "convertToUInt16", &err);
+      CHECK_CL_ERROR(err, "cl::Kernel");
+      err = kernel_convertDepth.setArg(0, config.EnableEdgeAwareFilter ? buf_filtered : buf_depth);
+      CHECK_CL_ERROR(err, "setArg");
+      err = kernel_convertDepth.setArg(1, buf_depth_uint16);
+      CHECK_CL_ERROR(err, "setArg");
+
+      cl::Event event0, event1, event2, event3, event4, event5;
       err = queue.enqueueWriteBuffer(buf_lut11to16, CL_FALSE, 0, buf_lut11to16_size, lut11to16, NULL, &event0);
       CHECK_CL_ERROR(err, "enqueueWriteBuffer");
       err = queue.enqueueWriteBuffer(buf_p0_table, CL_FALSE, 0, buf_p0_table_size, p0_table, NULL, &event1);
@@ -493,6 +637,10 @@ public:
       CHECK_CL_ERROR(err, "enqueueWriteBuffer");
       err = queue.enqueueWriteBuffer(buf_z_table, CL_FALSE, 0, buf_z_table_size, z_table, NULL, &event3);
       CHECK_CL_ERROR(err, "enqueueWriteBuffer");
+      err = queue.enqueueWriteBuffer(buf_row_offset, CL_FALSE, 0, buf_row_offset_size, decode_table.row_offset, NULL, &event4);
+      CHECK_CL_ERROR(err, "enqueueWriteBuffer");
+      err = queue.enqueueWriteBuffer(buf_column_bit, CL_FALSE, 0, buf_column_bit_size, decode_table.column_bit, NULL, &event5);
+      CHECK_CL_ERROR(err, "enqueueWriteBuffer");
 
       err = event0.wait();
       CHECK_CL_ERROR(err, "wait");
@@ -502,6 +650,18 @@ public:
       CHECK_CL_ERROR(err, "wait");
       err = event3.wait();
       CHECK_CL_ERROR(err, "wait");
+      err = event4.wait();
+      CHECK_CL_ERROR(err, "wait");
+      err = event5.wait();
+      CHECK_CL_ERROR(err, "wait");
+
+      if(config.EnableBinning)
+      {
+        err = queue.enqueueWriteBuffer(buf_binned_x_table, CL_TRUE, 0, output_size * sizeof(cl_float), binned_x_table);
+        CHECK_CL_ERROR(err, "enqueueWriteBuffer");
+        err = queue.enqueueWriteBuffer(buf_binned_z_table, CL_TRUE, 0, output_size * sizeof(cl_float), binned_z_table);
+        CHECK_CL_ERROR(err, "enqueueWriteBuffer");
+      }
     }
 
     programInitialized = true;
@@ -512,20 +672,51 @@ public:
   {
     cl_int err;
     {
-      std::vector<cl::Event> eventWrite(1), eventPPS1(1), eventFPS1(1), eventPPS2(1), eventFPS2(1);
-      cl::Event event0, event1;
+      std::vector<cl::Event> eventWrite(1), eventPPS1(1), eventFPS1(1), eventPPS2(1), eventFPS2(1), eventIr(1), eventDepth(1);
+      cl::Event event0, event1, event2;
 
       err = queue.enqueueWriteBuffer(buf_packet, CL_FALSE, 0, buf_packet_size, packet.buffer, NULL, &eventWrite[0]);
       CHECK_CL_ERROR(err, "enqueueWriteBuffer");
 
       err = queue.enqueueNDRangeKernel(kernel_processPixelStage1, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventWrite, &eventPPS1[0]);
       CHECK_CL_ERROR(err, "enqueueNDRangeKernel");
-      err = queue.enqueueReadBuffer(buf_ir, CL_FALSE, 0, buf_ir_size, ir_frame->data, &eventPPS1, &event0);
-      CHECK_CL_ERROR(err, "enqueueReadBuffer");
+
+      if(config.EnableBinning)
+      {
+        std::vector<cl::Event> eventStage1(eventPPS1);
+        err = queue.enqueueNDRangeKernel(kernel_binPixelStage1, cl::NullRange, cl::NDRange(output_size), cl::NullRange, &eventStage1, &eventPPS1[0]);
+        CHECK_CL_ERROR(err, "enqueueNDRangeKernel");
+      }
+
+      if(output_ir)
+      {
+        if(ir_frame->format == Frame::UInt16)
+        {
+          err = queue.enqueueNDRangeKernel(kernel_convertIr, cl::NullRange, cl::NDRange(output_size), cl::NullRange, &eventPPS1, &eventIr[0]);
+          CHECK_CL_ERROR(err, "enqueueNDRangeKernel");
+          err = queue.enqueueReadBuffer(buf_ir_uint16, CL_FALSE, 0, buf_uint16_size, ir_frame->data, &eventIr, &event0);
+        }
+        else
+        {
+          err = queue.enqueueReadBuffer(config.EnableBinning ? buf_ir_binned : buf_ir, CL_FALSE, 0, output_size * sizeof(cl_float), ir_frame->data, &eventPPS1, &event0);
+        }
+        CHECK_CL_ERROR(err, "enqueueReadBuffer");
+      }
+
+      // IR is computed in stage 1, the remaining stages only produce depth and confidence
+      if(!output_depth && !output_confidence)
+      {
+        if(output_ir)
+        {
+          err = event0.wait();
+          CHECK_CL_ERROR(err, "wait");
+        }
+        return true;
+      }
 
       if(config.EnableBilateralFilter)
       {
-        err = queue.enqueueNDRangeKernel(kernel_filterPixelStage1, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventPPS1, &eventFPS1[0]);
+        err = queue.enqueueNDRangeKernel(kernel_filterPixelStage1, cl::NullRange, cl::NDRange(output_size), cl::NullRange, &eventPPS1, &eventFPS1[0]);
         CHECK_CL_ERROR(err, "enqueueNDRangeKernel");
       }
       else
@@ -533,12 +724,12 @@ public:
         eventFPS1[0] = eventPPS1[0];
       }
 
-      err = queue.enqueueNDRangeKernel(kernel_processPixelStage2, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventFPS1, &eventPPS2[0]);
+      err = queue.enqueueNDRangeKernel(kernel_processPixelStage2, cl::NullRange, cl::NDRange(output_size), cl::NullRange, &eventFPS1, &eventPPS2[0]);
       CHECK_CL_ERROR(err, "enqueueNDRangeKernel");
 
       if(config.EnableEdgeAwareFilter)
       {
-        err = queue.enqueueNDRangeKernel(kernel_filterPixelStage2, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventPPS2, &eventFPS2[0]);
+        err = queue.enqueueNDRangeKernel(kernel_filterPixelStage2, cl::NullRange, cl::NDRange(output_size), cl::NullRange, &eventPPS2, &eventFPS2[0]);
         CHECK_CL_ERROR(err, "enqueueWriteBuffer");
       }
       else
@@ -546,12 +737,49 @@ public:
         eventFPS2[0] = eventPPS2[0];
       }
 
-      err = queue.enqueueReadBuffer(config.EnableEdgeAwareFilter ? buf_filtered : buf_depth, CL_FALSE, 0, buf_depth_size, depth_frame->data, &eventFPS2, &event1);
-      CHECK_CL_ERROR(err, "enqueueReadBuffer");
-      err = event0.wait();
-      CHECK_CL_ERROR(err, "wait");
-      err = event1.wait();
-      CHECK_CL_ERROR(err, "wait");
+      if(config.EnableTemporalFilter)
+      {
+        std::vector<cl::Event> eventFiltered(eventFPS2);
+        err = queue.enqueueNDRangeKernel(kernel_filterTemporal, cl::NullRange, cl::NDRange(output_size), cl::NullRange, &eventFiltered, &eventFPS2[0]);
+        CHECK_CL_ERROR(err, "enqueueNDRangeKernel");
+      }
+
+      if(output_depth)
+      {
+        if(depth_frame->format == Frame::UInt16)
+        {
+          err = queue.enqueueNDRangeKernel(kernel_convertDepth, cl::NullRange, cl::NDRange(output_size), cl::NullRange, &eventFPS2, &eventDepth[0]);
+          CHECK_CL_ERROR(err, "enqueueNDRangeKernel");
+          err = queue.enqueueReadBuffer(buf_depth_uint16, CL_FALSE, 0, buf_uint16_size, depth_frame->data, &eventDepth, &event1);
+        }
+        else
+        {
+          err = queue.enqueueReadBuffer(config.EnableEdgeAwareFilter ? buf_filtered : buf_depth, CL_FALSE, 0, buf_depth_size, depth_frame->data, &eventFPS2, &event1);
+        }
+        CHECK_CL_ERROR(err, "enqueueReadBuffer");
+      }
+
+      if(output_confidence)
+      {
+        err = queue.enqueueReadBuffer(buf_confidence, CL_FALSE, 0, output_size * sizeof(cl_uchar), confidence_frame->data, &eventFPS2, &event2);
+        CHECK_CL_ERROR(err, "enqueueReadBuffer");
+      }
+
+      if(output_ir)
+      {
+        err = event0.wait();
+        CHECK_CL_ERROR(err, "wait");
+      }
+      if(output_depth)
+      {
+        err = event1.wait();
+        CHECK_CL_ERROR(err, "wait");
+      }
+      if(output_confidence)
+      {
+        err = event2.wait();
+        CHECK_CL_ERROR(err, "wait");
+      }
     }
     return true;
   }
@@ -594,12 +822,59 @@ public:
 
   void newIrFrame()
   {
-    ir_frame = new Frame(512, 424, 4);
+    ir_frame = newFrame(ir_format);
   }
 
   void newDepthFrame()
   {
-    depth_frame = new Frame(512, 424, 4);
+    depth_frame = newFrame(depth_format);
+  }
+
+  void newConfidenceFrame()
+  {
+    confidence_frame = newFrame(Frame::Gray);
+  }
+
+  /** Allocate an output frame, 256x212 if binning, otherwise 512x424. */
+  Frame *newFrame(Frame::Format format) const
+  {
+    const size_t bytes_per_pixel = format == Frame::Gray ? 1 : format == Frame::UInt16 ? 2 : 4;
+    Frame *frame = config.EnableBinning ? new Frame(256, 212, bytes_per_pixel) : new Frame(512, 424, bytes_per_pixel);
+    frame->format = format;
+    return frame;
+  }
+
+  /** Use the outputs and output formats \a listener asks for; UInt16 or Float. Also reallocates frames of a stale size. */
+  void setOutputFormats(const libfreenect2::FrameListener *listener)
+  {
+    output_ir = listener->wantsFrameType(Frame::Ir);
+    output_depth = listener->wantsFrameType(Frame::Depth);
+    output_confidence = listener->wantsFrameType(Frame::Confidence);
+
+    Frame::Format ir = listener->getFrameFormat(Frame::Ir) == Frame::UInt16 ? Frame::UInt16 : Frame::Float;
+    Frame::Format depth = listener->getFrameFormat(Frame::Depth) == Frame::UInt16 ? Frame::UInt16 : Frame::Float;
+
+    size_t width = config.EnableBinning ? 256 : 512;
+
+    if(ir != ir_format || ir_frame->width != width)
+    {
+      ir_format = ir;
+      delete ir_frame;
+      newIrFrame();
+    }
+
+    if(depth != depth_format || depth_frame->width != width)
+    {
+      depth_format = depth;
+      delete depth_frame;
+      newDepthFrame();
+    }
+
+    if(confidence_frame->width != width)
+    {
+      delete confidence_frame;
+      newConfidenceFrame();
+    }
   }
 
   void fill_trig_table(const libfreenect2::protocol::P0TablesResponse *p0table)
@@ -636,14 +911,19 @@ void OpenCLDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacke
   DepthPacketProcessor::setConfiguration(config);
 
   if ( impl_->config.MaxDepth != config.MaxDepth 
-    || impl_->config.MinDepth != config.MinDepth)
+    || impl_->config.MinDepth != config.MinDepth
+    || impl_->config.EnableFastMath != config.EnableFastMath
+    || impl_->config.EnableBinning != config.EnableBinning
+    || impl_->config.TemporalFilterAlpha != config.TemporalFilterAlpha
+    || impl_->config.TemporalFilterThreshold != config.TemporalFilterThreshold)
   {
     // OpenCL program needs to be rebuilt, then reinitialized
     impl_->programBuilt = false;
     impl_->programInitialized = false;
   }
   else if (impl_->config.EnableBilateralFilter != config.EnableBilateralFilter
-    || impl_->config.EnableEdgeAwareFilter != config.EnableEdgeAwareFilter)
+    || impl_->config.EnableEdgeAwareFilter != config.EnableEdgeAwareFilter
+    || impl_->config.EnableTemporalFilter != config.EnableTemporalFilter)
   {
     // OpenCL program only needs to be reinitialized
     impl_->programInitialized = false;
@@ -654,6 +934,11 @@ void OpenCLDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacke
     impl_->buildProgram(impl_->sourceCode);
 }
 
+bool OpenCLDepthPacketProcessor::supportsBinning() const
+{
+  return true;
+}
+
 void OpenCLDepthPacketProcessor::loadP0TablesFromCommandResponse(unsigned char *buffer, size_t buffer_length)
 {
   libfreenect2::protocol::P0TablesResponse *p0table = (libfreenect2::protocol::P0TablesResponse *)buffer;
@@ -671,6 +956,7 @@ void OpenCLDepthPacketProcessor::loadXZTables(const float *xtable, const float *
 {
   std::copy(xtable, xtable + TABLE_SIZE, impl_->x_table);
   std::copy(ztable, ztable + TABLE_SIZE, impl_->z_table);
+  binXZTables(xtable, ztable, impl_->binned_x_table, impl_->binned_z_table);
 }
 
 void OpenCLDepthPacketProcessor::loadLookupTable(const short *lut)
@@ -682,6 +968,9 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
 {
   bool has_listener = this->listener_ != 0;
 
+  if(has_listener && !this->listener_->wantsFrameType(Frame::Ir) && !this->listener_->wantsFrameType(Frame::Depth) && !this->listener_->wantsFrameType(Frame::Confidence))
+    return;
+
   if(!impl_->programInitialized && !impl_->initProgram())
   {
     LOG_ERROR << "could not initialize OpenCLDepthPacketProcessor";
@@ -690,10 +979,17 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
 
   impl_->startTiming();
 
+  if(has_listener)
+  {
+    impl_->setOutputFormats(this->listener_);
+  }
+
   impl_->ir_frame->timestamp = packet.timestamp;
   impl_->depth_frame->timestamp = packet.timestamp;
   impl_->ir_frame->sequence = packet.sequence;
   impl_->depth_frame->sequence = packet.sequence;
+  impl_->confidence_frame->timestamp = packet.timestamp;
+  impl_->confidence_frame->sequence = packet.sequence;
 
   bool r = impl_->run(packet);
 
@@ -701,15 +997,20 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
 
   if(has_listener && r)
   {
-    if(this->listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
+    if(impl_->output_ir && this->listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
     {
       impl_->newIrFrame();
     }
 
-    if(this->listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
+    if(impl_->output_depth && this->listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
     {
       impl_->newDepthFrame();
     }
+
+    if(impl_->output_confidence && this->listener_->onNewFrame(Frame::Confidence, impl_->confidence_frame))
+    {
+      impl_->newConfidenceFrame();
+    }
   }
 }
 
@@ -398,7 +398,7 @@ public:
   GLFWwindow *opengl_context_ptr;
   libfreenect2::DepthPacketProcessor::Config config;
 
-  GLuint square_vbo, square_vao, stage1_framebuffer, filter1_framebuffer, stage2_framebuffer, filter2_framebuffer;
+  GLuint square_vbo, square_vao, stage1_framebuffer, filter1_framebuffer, stage2_framebuffer, filter2_framebuffer, uint16_framebuffer;
   Texture<S16C1> lut11to16;
   Texture<U16C1> p0table[3];
   Texture<F32C1> x_table, z_table;
@@ -421,13 +421,17 @@ public:
   Texture<F32C4> filter2_debug;
   Texture<F32C1> filter2_depth;
 
-  ShaderProgram stage1, filter1, stage2, filter2, debug;
+  Texture<U16C1> ir_uint16, depth_uint16;
+
+  ShaderProgram stage1, filter1, stage2, filter2, uint16, debug;
 
   DepthPacketProcessor::Parameters params;
   bool params_need_update;
 
   bool do_debug;
 
+  Frame::Format ir_format, depth_format; ///< Float or UInt16.
+
   struct Vertex
   {
     float x, y;
@@ -442,8 +446,11 @@ public:
     filter1_framebuffer(0),
     stage2_framebuffer(0),
     filter2_framebuffer(0),
+    uint16_framebuffer(0),
     params_need_update(true),
-    do_debug(debug)
+    do_debug(debug),
+    ir_format(Frame::Float),
+    depth_format(Frame::Float)
   {
   }
 
@@ -487,11 +494,15 @@ public:
 
     filter2_debug.gl(b);
     filter2_depth.gl(b);
+
+    ir_uint16.gl(b);
+    depth_uint16.gl(b);
  
     stage1.gl(b);
     filter1.gl(b);
     stage2.gl(b);
     filter2.gl(b);
+    uint16.gl(b);
     debug.gl(b);
   }
 
@@ -550,6 +561,9 @@ public:
     if(do_debug) filter2_debug.allocate(512, 424);
     filter2_depth.allocate(512, 424);
 
+    ir_uint16.allocate(512, 424);
+    depth_uint16.allocate(512, 424);
+
     stage1.setVertexShader(loadShaderSource("default.vs"));
     stage1.setFragmentShader(loadShaderSource("stage1.fs"));
     stage1.bindFragDataLocation("Debug", 0);
@@ -580,6 +594,11 @@ public:
     filter2.bindFragDataLocation("FilterDepth", 1);
     filter2.build();
 
+    uint16.setVertexShader(loadShaderSource("default.vs"));
+    uint16.setFragmentShader(loadShaderSource("uint16.fs"));
+    uint16.bindFragDataLocation("Value", 0);
+    uint16.build();
+
     if(do_debug)
     {
       debug.setVertexShader(loadShaderSource("default.vs"));
@@ -640,6 +659,16 @@ public:
     gl()->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_RECTANGLE, filter2_depth.texture, 0);
     checkFBO(GL_FRAMEBUFFER);
 
+    gl()->glGenFramebuffers(1, &uint16_framebuffer);
+    gl()->glBindFramebuffer(GL_FRAMEBUFFER, uint16_framebuffer);
+
+    const GLenum uint16_buffers[] = { GL_COLOR_ATTACHMENT0 };
+    gl()->glDrawBuffers(1, uint16_buffers);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    gl()->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, ir_uint16.texture, 0);
+    checkFBO(GL_FRAMEBUFFER);
+
     Vertex bl = {-1.0f, -1.0f, 0.0f, 0.0f }, br = { 1.0f, -1.0f, 512.0f, 0.0f }, tl = {-1.0f, 1.0f, 0.0f, 424.0f }, tr = { 1.0f, 1.0f, 512.0f, 424.0f };
     Vertex vertices[] = {
         bl, tl, tr, tr, br, bl
@@ -701,6 +730,38 @@ public:
     program.setUniform("Params.max_depth", params.max_depth);
   }
 
+  /**
+   * Download \a in in \a format. For Frame::UInt16 it is converted on the GPU
+   * into \a out first, so only half of the data is transferred.
+   */
+  Frame *downloadToNewFrame(Texture<F32C1> &in, Texture<U16C1> &out, Frame::Format format)
+  {
+    Frame *frame;
+
+    if(format == Frame::UInt16)
+    {
+      gl()->glBindFramebuffer(GL_FRAMEBUFFER, uint16_framebuffer);
+      gl()->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, out.texture, 0);
+
+      uint16.use();
+      in.bindToUnit(GL_TEXTURE0);
+      uint16.setUniform("Data", 0);
+
+      gl()->glBindVertexArray(square_vao);
+      glDrawArrays(GL_TRIANGLES, 0, 6);
+
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+      frame = out.downloadToNewFrame();
+    }
+    else
+    {
+      frame = in.downloadToNewFrame();
+    }
+    frame->format = format;
+
+    return frame;
+  }
+
   void run(Frame **ir, Frame **depth)
   {
     // data processing 1
@@ -732,9 +793,13 @@ public:
     {
       gl()->glBindFramebuffer(GL_READ_FRAMEBUFFER, stage1_framebuffer);
       glReadBuffer(GL_COLOR_ATTACHMENT4);
-      *ir = stage1_infrared.downloadToNewFrame();
+      *ir = downloadToNewFrame(stage1_infrared, ir_uint16, ir_format);
     }
 
+    // IR is computed in stage 1, the remaining stages only produce depth
+    if(depth == 0 && !do_debug)
+      return;
+
     if(config.EnableBilateralFilter)
     {
       // bilateral filter
@@ -803,7 +868,7 @@ public:
       {
         gl()->glBindFramebuffer(GL_READ_FRAMEBUFFER, filter2_framebuffer);
         glReadBuffer(GL_COLOR_ATTACHMENT1);
-        *depth = filter2_depth.downloadToNewFrame();
+        *depth = downloadToNewFrame(filter2_depth, depth_uint16, depth_format);
       }
     }
     else
@@ -812,7 +877,7 @@ public:
       {
         gl()->glBindFramebuffer(GL_READ_FRAMEBUFFER, stage2_framebuffer);
         glReadBuffer(GL_COLOR_ATTACHMENT1);
-        *depth = stage2_depth.downloadToNewFrame();
+        *depth = downloadToNewFrame(stage2_depth, depth_uint16, depth_format);
       }
     }
     CHECKGL();
@@ -955,42 +1020,52 @@ void OpenGLDepthPacketProcessor::loadLookupTable(const short *lut)
 void OpenGLDepthPacketProcessor::process(const DepthPacket &packet)
 {
   bool has_listener = this->listener_ != 0;
+  bool want_ir = has_listener && this->listener_->wantsFrameType(Frame::Ir);
+  bool want_depth = has_listener && this->listener_->wantsFrameType(Frame::Depth);
   Frame *ir = 0, *depth = 0;
 
+  if(has_listener && !want_ir && !want_depth)
+    return;
+
   impl_->startTiming();
 
   glfwMakeContextCurrent(impl_->opengl_context_ptr);
 
+  if(has_listener)
+  {
+    impl_->ir_format = this->listener_->getFrameFormat(Frame::Ir) == Frame::UInt16 ? Frame::UInt16 : Frame::Float;
+    impl_->depth_format = this->listener_->getFrameFormat(Frame::Depth) == Frame::UInt16 ? Frame::UInt16 : Frame::Float;
+  }
+
   std::copy(packet.buffer, packet.buffer + packet.buffer_length/10*9, impl_->input_data.data);
   impl_->input_data.upload();
-  impl_->run(has_listener ? &ir : 0, has_listener ? &depth : 0);
+  impl_->run(want_ir ? &ir : 0, want_depth ? &depth : 0);
 
   if(impl_->do_debug) glfwSwapBuffers(impl_->opengl_context_ptr);
 
   impl_->stopTiming(LOG_INFO);
 
-  if(has_listener)
+  if(want_ir)
   {
     ir->timestamp = packet.timestamp;
-    depth->timestamp = packet.timestamp;
     ir->sequence = packet.sequence;
-    depth->sequence = packet.sequence;
 
     if(!this->listener_->onNewFrame(Frame::Ir, ir))
     {
       delete ir;
     }
+  }
+
+  if(want_depth)
+  {
+    depth->timestamp = packet.timestamp;
+    depth->sequence = packet.sequence;
 
     if(!this->listener_->onNewFrame(Frame::Depth, depth))
     {
       delete depth;
     }
   }
-  else
-  {
-    delete ir;
-    delete depth;
-  }
 }
 
 } /* namespace libfreenect2 */
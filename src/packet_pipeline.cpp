@@ -42,9 +42,9 @@ public:
   DepthPacketStreamParser *depth_parser_;
 
   RgbPacketProcessor *rgb_processor_;
-  BaseRgbPacketProcessor *async_rgb_processor_;
+  AsyncPacketProcessor<RgbPacket> *async_rgb_processor_;
   DepthPacketProcessor *depth_processor_;
-  BaseDepthPacketProcessor *async_depth_processor_;
+  AsyncPacketProcessor<DepthPacket> *async_depth_processor_;
 
   ~PacketPipelineComponents();
   void initialize(RgbPacketProcessor *rgb, DepthPacketProcessor *depth);
@@ -92,6 +92,32 @@ PacketPipeline::PacketParser *PacketPipeline::getIrPacketParser() const
   return comp_->depth_parser_;
 }
 
+RgbPacketStreamParser *PacketPipeline::getRgbPacketStreamParser() const
+{
+  return comp_->rgb_parser_;
+}
+
+DepthPacketStreamParser *PacketPipeline::getDepthPacketStreamParser() const
+{
+  return comp_->depth_parser_;
+}
+
+void PacketPipeline::setPacketBuffers(int count, bool drop_oldest) const
+{
+  size_t buffers = (count > 2) ? count : 2;
+
+  // the parser keeps one buffer to assemble the next packet
+  comp_->async_rgb_processor_->setQueue(buffers - 1, drop_oldest);
+  comp_->async_depth_processor_->setQueue(buffers - 1, drop_oldest);
+  comp_->rgb_parser_->setBufferCount(buffers);
+  comp_->depth_parser_->setBufferCount(buffers);
+}
+
+size_t PacketPipeline::getDepthFrameHeapAllocations() const
+{
+  return comp_->depth_processor_->getFrameHeapAllocations();
+}
+
 RgbPacketProcessor *PacketPipeline::getRgbPacketProcessor() const
 {
   return comp_->rgb_processor_;
@@ -102,17 +128,17 @@ DepthPacketProcessor *PacketPipeline::getDepthPacketProcessor() const
   return comp_->depth_processor_;
 }
 
-CpuPacketPipeline::CpuPacketPipeline()
+CpuPacketPipeline::CpuPacketPipeline(const int num_threads, const int pipeline_stages, const int color_decoders) : num_threads_(num_threads), pipeline_stages_(pipeline_stages), color_decoders_(color_decoders)
 { 
-  comp_->initialize(new TurboJpegRgbPacketProcessor(), new CpuDepthPacketProcessor());
+  comp_->initialize(new TurboJpegRgbPacketProcessor(color_decoders_), new CpuDepthPacketProcessor(num_threads_, pipeline_stages_));
 }
 
 CpuPacketPipeline::~CpuPacketPipeline() { }
 
 #ifdef LIBFREENECT2_WITH_OPENGL_SUPPORT
-OpenGLPacketPipeline::OpenGLPacketPipeline(void *parent_opengl_context, bool debug) : parent_opengl_context_(parent_opengl_context), debug_(debug)
+OpenGLPacketPipeline::OpenGLPacketPipeline(void *parent_opengl_context, bool debug, const int color_decoders) : parent_opengl_context_(parent_opengl_context), debug_(debug), color_decoders_(color_decoders)
 { 
-  comp_->initialize(new TurboJpegRgbPacketProcessor(), new OpenGLDepthPacketProcessor(parent_opengl_context_, debug_));
+  comp_->initialize(new TurboJpegRgbPacketProcessor(color_decoders_), new OpenGLDepthPacketProcessor(parent_opengl_context_, debug_));
 }
 
 OpenGLPacketPipeline::~OpenGLPacketPipeline() { }
@@ -121,9 +147,9 @@ OpenGLPacketPipeline::~OpenGLPacketPipeline() { }
 
 #ifdef LIBFREENECT2_WITH_OPENCL_SUPPORT
 
-OpenCLPacketPipeline::OpenCLPacketPipeline(const int deviceId) : deviceId(deviceId)
+OpenCLPacketPipeline::OpenCLPacketPipeline(const int deviceId, const int color_decoders) : deviceId(deviceId), color_decoders_(color_decoders)
 { 
-  comp_->initialize(new TurboJpegRgbPacketProcessor(), new OpenCLDepthPacketProcessor(deviceId));
+  comp_->initialize(new TurboJpegRgbPacketProcessor(color_decoders_), new OpenCLDepthPacketProcessor(deviceId));
 }
 
 OpenCLPacketPipeline::~OpenCLPacketPipeline() { }
@@ -30,6 +30,7 @@
 #include <math.h>
 #include <libfreenect2/registration.h>
 #include <limits>
+#include <algorithm>
 
 namespace libfreenect2
 {
@@ -125,9 +126,15 @@ void Registration::apply(const Frame *rgb, const Frame *depth, Frame *undistorte
 
 void RegistrationImpl::apply(const Frame *rgb, const Frame *depth, Frame *undistorted, Frame *registered, const bool enable_filter, Frame *bigdepth, int *color_depth_map) const
 {
+  // color frames may be downscaled by 1, 2, 4 or 8, and cropped
+  int scale_shift = 0;
+  while(rgb && scale_shift < 3 && rgb->full_width < (1920u >> scale_shift))
+    ++scale_shift;
+
   // Check if all frames are valid and have the correct size
   if (!rgb || !depth || !undistorted || !registered ||
-      rgb->width != 1920 || rgb->height != 1080 || rgb->bytes_per_pixel != 4 ||
+      rgb->full_width != (1920u >> scale_shift) || rgb->full_height != (1080u >> scale_shift) || rgb->bytes_per_pixel != 4 ||
+      rgb->x_offset + rgb->width > rgb->full_width || rgb->y_offset + rgb->height > rgb->full_height ||
       depth->width != 512 || depth->height != 424 || depth->bytes_per_pixel != 4 ||
       undistorted->width != 512 || undistorted->height != 424 || undistorted->bytes_per_pixel != 4 ||
       registered->width != 512 || registered->height != 424 || registered->bytes_per_pixel != 4)
@@ -142,14 +149,24 @@ void RegistrationImpl::apply(const Frame *rgb, const Frame *depth, Frame *undist
   const int *map_yi = depth_to_color_map_yi;
 
   const int size_depth = 512 * 424;
-  const int size_color = 1920 * 1080;
+  const int size_full_color = 1920 * 1080;
+  const int color_width = rgb->width;
+  const int color_height = rgb->height;
+  const int color_x_offset = rgb->x_offset;
+  const int color_y_offset = rgb->y_offset;
+  const int size_color = color_width * color_height;
   const float color_cx = color.cx + 0.5f; // 0.5f added for later rounding
 
+  // the filter window is given in full size pixels, at least one pixel of the downscaled image.
+  // it is never taller than filter_height_half, so the border of the filter map stays the same.
+  const int window_width_half = std::max(filter_width_half >> scale_shift, 1);
+  const int window_height_half = std::max(filter_height_half >> scale_shift, 1);
+
   // size of filter map with a border of filter_height_half on top and bottom so that no check for borders is needed.
-  // since the color image is wide angle no border to the sides is needed.
-  const int size_filter_map = size_color + 1920 * filter_height_half * 2;
+  // there is no border to the sides, the filter window is clipped to the width, which only matters for cropped color images.
+  const int size_filter_map = size_color + color_width * filter_height_half * 2;
   // offset to the important data
-  const int offset_filter_map = 1920 * filter_height_half;
+  const int offset_filter_map = color_width * filter_height_half;
 
   // map for storing the min z values used for each color pixel
   float *filter_map = NULL;
@@ -199,29 +216,39 @@ void RegistrationImpl::apply(const Frame *rgb, const Frame *depth, Frame *undist
 
     // calculating x offset for rgb image based on depth value
     const float rx = (*map_x + (color.shift_m / z)) * color.fx + color_cx;
-    const int cx = rx; // same as round for positive numbers (0.5f was already added to color_cx)
+    const int full_cx = rx; // same as round for positive numbers (0.5f was already added to color_cx)
     // getting y offset for depth image
-    const int cy = *map_yi;
+    const int full_cy = *map_yi;
     // combining offsets
-    const int c_off = cx + cy * 1920;
+    const int full_c_off = full_cx + full_cy * 1920;
 
     // check if c_off is outside of rgb image
     // checking rx/cx is not needed because the color image is much wider then the depth image
-    if(c_off < 0 || c_off >= size_color){
+    if(full_c_off < 0 || full_c_off >= size_full_color){
       *map_c_off = -1;
       continue;
     }
 
+    // pixel of the downscaled and cropped rgb image covering the full size pixel
+    const int cx = (full_cx >> scale_shift) - color_x_offset;
+    const int cy = (full_cy >> scale_shift) - color_y_offset;
+
+    // check if the pixel is outside of a cropped rgb image
+    const bool inside = cx >= 0 && cx < color_width && cy >= 0 && cy < color_height;
+
     // saving the offset for later
-    *map_c_off = c_off;
+    *map_c_off = inside ? cx + cy * color_width : -1;
 
     if(enable_filter){
       // setting a window around the filter map pixel corresponding to the color pixel with the current z value
-      int yi = (cy - filter_height_half) * 1920 + cx - filter_width_half; // index of first pixel to set
-      for(int r = -filter_height_half; r <= filter_height_half; ++r, yi += 1920) // index increased by a full row each iteration
+      // the window is clipped to the image and its top and bottom border, so pixels just outside of a cropped image still hide pixels inside
+      const int c_begin = std::max(-window_width_half, -cx), c_end = std::min(window_width_half, color_width - 1 - cx);
+      const int r_begin = std::max(-window_height_half, -filter_height_half - cy), r_end = std::min(window_height_half, color_height - 1 + filter_height_half - cy);
+      int yi = (cy + r_begin) * color_width + cx + c_begin; // index of first pixel to set
+      for(int r = r_begin; r <= r_end; ++r, yi += color_width) // index increased by a full row each iteration
       {
         float *it = p_filter_map + yi;
-        for(int c = -filter_width_half; c <= filter_width_half; ++c, ++it)
+        for(int c = c_begin; c <= c_end; ++c, ++it)
         {
           // only set if the current z is smaller
           if(z < *it)
@@ -29,8 +29,7 @@
 #include <libfreenect2/rgb_packet_processor.h>
 #include <libfreenect2/async_packet_processor.h>
 
-#include <fstream>
-#include <string>
+#include <cstring>
 
 namespace libfreenect2
 {
@@ -49,6 +48,26 @@ void RgbPacketProcessor::setFrameListener(libfreenect2::FrameListener *listener)
   listener_ = listener;
 }
 
+void RgbPacketProcessor::setConfiguration(const libfreenect2::Freenect2Device::Config &)
+{
+}
+
+void RgbPacketProcessor::deliverRaw(const RgbPacket &packet)
+{
+  // the packet buffer is reused once process() returns, so the frame gets a copy
+  Frame *frame = new Frame(packet.jpeg_buffer_length, 1, 1);
+  std::memcpy(frame->data, packet.jpeg_buffer, packet.jpeg_buffer_length);
+  frame->format = Frame::Raw;
+  frame->timestamp = packet.timestamp;
+  frame->sequence = packet.sequence;
+  frame->exposure = packet.exposure;
+  frame->gain = packet.gain;
+  frame->gamma = packet.gamma;
+
+  if(!listener_->onNewFrame(Frame::Color, frame))
+    delete frame;
+}
+
 DumpRgbPacketProcessor::DumpRgbPacketProcessor()
 {
 }
@@ -59,12 +78,10 @@ DumpRgbPacketProcessor::~DumpRgbPacketProcessor()
 
 void DumpRgbPacketProcessor::process(const RgbPacket &packet)
 {
-  //std::stringstream name;
-  //name << packet->sequence << "_" << packet->unknown0 << "_" << jpeg_buffer_length << ".jpeg";
-  //
-  //std::ofstream file(name.str().c_str());
-  //file.write(reinterpret_cast<char *>(packet->jpeg_buffer), jpeg_buffer_length);
-  //file.close();
+  if(listener_ == 0 || !listener_->wantsFrameType(Frame::Color))
+    return;
+
+  deliverRaw(packet);
 }
 
 } /* namespace libfreenect2 */
@@ -62,9 +62,13 @@ LIBFREENECT2_PACK(struct RgbPacketFooter {
 });
 
 RgbPacketStreamParser::RgbPacketStreamParser() :
-    processor_(noopProcessor<RgbPacket>())
+    processor_(noopProcessor<RgbPacket>()),
+    last_sequence_(0),
+    buffer_full_(false)
 {
-  buffer_.allocate(1920*1080*3+sizeof(RgbPacket));
+  setBufferCount(2);
+
+  memset(&statistics_, 0, sizeof(statistics_));
 }
 
 RgbPacketStreamParser::~RgbPacketStreamParser()
@@ -76,8 +80,73 @@ void RgbPacketStreamParser::setPacketProcessor(BaseRgbPacketProcessor *processor
   processor_ = (processor != 0) ? processor : noopProcessor<RgbPacket>();
 }
 
+void RgbPacketStreamParser::setBufferCount(size_t count)
+{
+  buffer_.allocate(1920*1080*3+sizeof(RgbPacket), count);
+  buffer_full_ = false;
+}
+
+/**
+ * Get the statistics of the stream, can be called from any thread.
+ * @return Copy of the counters.
+ */
+Freenect2Device::StreamStatistics RgbPacketStreamParser::getStatistics() const
+{
+  Freenect2Device::StreamStatistics statistics;
+
+  // all counters are uint32_t, each one is read atomically
+  const uint32_t *src = reinterpret_cast<const uint32_t *>(&statistics_);
+  uint32_t *dst = reinterpret_cast<uint32_t *>(&statistics);
+  for(size_t i = 0; i < sizeof(statistics) / sizeof(uint32_t); ++i)
+    dst[i] = atomicLoad(src[i]);
+
+  return statistics;
+}
+
+/**
+ * Count a received packet and the sequence numbers skipped before it.
+ * @param sequence Sequence number from the packet footer.
+ */
+void RgbPacketStreamParser::countSequence(uint32_t sequence)
+{
+  atomicAdd(statistics_.received, 1);
+  if (statistics_.received > 1 && sequence != last_sequence_ + 1)
+  {
+    atomicAdd(statistics_.sequence_gaps, 1);
+    // a sequence going backwards is a resync, nothing was lost
+    if (sequence > last_sequence_)
+      atomicAdd(statistics_.lost, sequence - last_sequence_ - 1);
+  }
+  last_sequence_ = sequence;
+}
+
 void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
 {
+
+  // the front buffer is still held by the processor, drop data up to the end
+  // of a packet and retry there, a packet always ends with a transfer
+  if(buffer_full_ && length > 0)
+  {
+    if(length >= sizeof(RgbPacketFooter))
+    {
+      const RgbPacketFooter *footer = reinterpret_cast<const RgbPacketFooter *>(&buffer[length - sizeof(RgbPacketFooter)]);
+
+      if (footer->magic_header == 0x39393939 && footer->magic_footer == 0x42424242)
+      {
+        LOG_DEBUG << "dropping rgb packet, no free buffer";
+        countSequence(footer->sequence);
+        atomicAdd(statistics_.dropped, 1);
+
+        if(buffer_.next())
+        {
+          buffer_.front().length = 0;
+          buffer_full_ = false;
+        }
+      }
+    }
+    return;
+  }
+
   Buffer &fb = buffer_.front();
 
   // package containing data
@@ -91,6 +160,7 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
     else
     {
       LOG_ERROR << "buffer overflow!";
+      atomicAdd(statistics_.oversized, 1);
       fb.length = 0;
       return;
     }
@@ -105,9 +175,12 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
     {
       RawRgbPacket *raw_packet = reinterpret_cast<RawRgbPacket *>(fb.data);
 
+      countSequence(footer->sequence);
+
       if (fb.length != footer->packet_size || raw_packet->sequence != footer->sequence)
       {
         LOG_ERROR << "packetsize or sequence doesn't match!";
+        atomicAdd(statistics_.invalid, 1);
         fb.length = 0;
         return;
       }
@@ -115,6 +188,7 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
       if (fb.length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) < footer->filler_length)
       {
         LOG_ERROR << "not enough space for packet filler!";
+        atomicAdd(statistics_.invalid, 1);
         fb.length = 0;
         return;
       }
@@ -135,6 +209,7 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
       if (jpeg_length == 0)
       {
         LOG_ERROR << "no JPEG detected!";
+        atomicAdd(statistics_.invalid, 1);
         fb.length = 0;
         return;
       }
@@ -142,10 +217,6 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
       // can the processor handle the next image?
       if(processor_->ready())
       {
-        buffer_.swap();
-        Buffer &bb = buffer_.back();
-
-        RawRgbPacket *raw_packet = reinterpret_cast<RawRgbPacket *>(bb.data);
         RgbPacket rgb_packet;
         rgb_packet.sequence = raw_packet->sequence;
         rgb_packet.timestamp = footer->timestamp;
@@ -154,13 +225,23 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
         rgb_packet.gamma = footer->gamma;
         rgb_packet.jpeg_buffer = raw_packet->jpeg_buffer;
         rgb_packet.jpeg_buffer_length = jpeg_length;
+        rgb_packet.memory = &fb;
 
         // call the processor
         processor_->process(rgb_packet);
+        atomicAdd(statistics_.assembled, 1);
+
+        // continue in a free buffer, the processor releases this one
+        if(!buffer_.next())
+        {
+          buffer_full_ = true;
+          return;
+        }
       }
       else
       {
         LOG_DEBUG << "skipping rgb packet!";
+        atomicAdd(statistics_.busy, 1);
       }
 
       // reset front buffer
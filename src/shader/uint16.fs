@@ -0,0 +1,13 @@
+uniform sampler2DRect Data;
+
+in vec2 TexCoord;
+
+out uint Value;
+
+void main(void)
+{
+  ivec2 uv = ivec2(TexCoord.x, TexCoord.y);
+  float v = texelFetch(Data, uv).x;
+
+  Value = v > 0.0 ? uint(min(v, 65535.0) + 0.5) : 0u;
+}
@@ -28,21 +28,68 @@
 
 #include <libfreenect2/rgb_packet_processor.h>
 #include <libfreenect2/logging.h>
+#include <libfreenect2/threading.h>
 #include <turbojpeg.h>
+#include <vector>
+#include <cstring>
+#include <algorithm>
 
 namespace libfreenect2
 {
 
-/** Implementation of the Turbo-Jpeg decoder processor. */
-class TurboJpegRgbPacketProcessorImpl: public WithPerfLogging
+/** A TurboJPEG decompressor with the frame it decodes into. */
+class TurboJpegDecoder: public WithPerfLogging
 {
 public:
+  /** State of a decoder in the #TurboJpegRgbPacketProcessorImpl pool. */
+  enum State
+  {
+    Idle,     ///< Free for the next packet.
+    Queued,   ///< Holds a packet waiting for a worker.
+    Decoding, ///< A worker decodes the packet.
+    Decoded   ///< Waiting to be passed to the listener in order.
+  };
 
   tjhandle decompressor;
+  tjhandle transformer; ///< Crops JPEGs losslessly, created for the first region of interest.
 
   Frame *frame;
+  Frame::Format format;   ///< Format of #frame, see supportedFormat().
+  int scale;              ///< Frames are decoded from 1920x1080 divided by the scale.
+  int width, height;      ///< Size of #frame.
+  int x_offset, y_offset; ///< Position of #frame in the downscaled image.
+  int roi_x, roi_y, roi_width, roi_height; ///< Region to decode, in pixels of the 1920x1080 image.
+  unsigned char *cropped;       ///< Cropped JPEG, allocated by TurboJPEG.
+  unsigned long cropped_length; ///< Length of #cropped.
+  std::vector<unsigned char> yuv; ///< Planes in the subsampling of the JPEG, for conversion to I420.
+
+  State state;
+  bool ok;                ///< Whether the last decode succeeded.
+  unsigned int ticket;    ///< Submission order of the packet.
+  FrameListener *listener;
+  std::vector<unsigned char> jpeg; ///< Copy of the JPEG data, the packet buffer is released when process() returns.
+  size_t jpeg_length;
 
-  TurboJpegRgbPacketProcessorImpl()
+  TurboJpegDecoder() :
+    transformer(0),
+    frame(0),
+    format(Frame::BGRX),
+    scale(1),
+    width(1920),
+    height(1080),
+    x_offset(0),
+    y_offset(0),
+    roi_x(0),
+    roi_y(0),
+    roi_width(1920),
+    roi_height(1080),
+    cropped(0),
+    cropped_length(0),
+    state(Idle),
+    ok(false),
+    ticket(0),
+    listener(0),
+    jpeg_length(0)
   {
     decompressor = tjInitDecompress();
     if(decompressor == 0)
@@ -53,10 +100,21 @@ public:
     newFrame();
   }
 
-  ~TurboJpegRgbPacketProcessorImpl()
+  ~TurboJpegDecoder()
   {
     delete frame;
 
+    if(cropped != 0)
+      tjFree(cropped);
+
+    if(transformer != 0)
+    {
+      if(tjDestroy(transformer) == -1)
+      {
+        LOG_ERROR << "Failed to destroy TurboJPEG transformer! TurboJPEG error: '" << tjGetErrorStr() << "'";
+      }
+    }
+
     if(decompressor != 0)
     {
       if(tjDestroy(decompressor) == -1)
@@ -66,14 +124,537 @@ public:
     }
   }
 
+  /** The format of color frames the decoder produces for a listener asking for \a format. */
+  static Frame::Format supportedFormat(Frame::Format format)
+  {
+    switch(format)
+    {
+    case Frame::RGBX:
+    case Frame::RGB:
+    case Frame::Gray:
+    case Frame::I420:
+      return format;
+    default:
+      return Frame::BGRX;
+    }
+  }
+
+  static size_t bytesPerPixel(Frame::Format format)
+  {
+    switch(format)
+    {
+    case Frame::RGB:
+      return 3;
+    case Frame::Gray:
+    case Frame::I420:
+      return 1;
+    default:
+      return 4;
+    }
+  }
+
   void newFrame()
   {
-    frame = new Frame(1920, 1080, tjPixelSize[TJPF_BGRX]);
+    if(format == Frame::I420)
+    {
+      // the luma rows are followed by the two chroma planes
+      const int chroma_size = ((width + 1) / 2) * ((height + 1) / 2);
+      frame = new Frame(width, height + (2 * chroma_size + width - 1) / width, 1);
+      frame->height = height;
+    }
+    else
+    {
+      frame = new Frame(width, height, bytesPerPixel(format));
+    }
+    frame->format = format;
+    frame->x_offset = x_offset;
+    frame->y_offset = y_offset;
+    frame->full_width = 1920 / scale;
+    frame->full_height = 1080 / scale;
+  }
+
+  /** Replace #frame if the listener asks for another format. */
+  void setFormat(Frame::Format new_format)
+  {
+    new_format = supportedFormat(new_format);
+
+    if(new_format != format)
+    {
+      format = new_format;
+      delete frame;
+      newFrame();
+    }
+  }
+
+  /** Set the scale and the region of interest, #frame is resized by decode(). */
+  void setRegion(int new_scale, int x, int y, int region_width, int region_height)
+  {
+    scale = new_scale;
+    roi_x = x;
+    roi_y = y;
+    roi_width = region_width;
+    roi_height = region_height;
+  }
+
+  /** Place #frame at \a x, \a y of the downscaled image, replacing it if the size changed. */
+  void resize(int x, int y, int new_width, int new_height)
+  {
+    x_offset = x;
+    y_offset = y;
+
+    if(new_width != width || new_height != height)
+    {
+      width = new_width;
+      height = new_height;
+      delete frame;
+      newFrame();
+    }
+
+    frame->x_offset = x_offset;
+    frame->y_offset = y_offset;
+    frame->full_width = 1920 / scale;
+    frame->full_height = 1080 / scale;
+  }
+
+  /**
+   * Losslessly crop the JPEG to the region of interest widened to its MCU
+   * grid, so only the region is decoded, and resize #frame for it.
+   * \a jpeg and \a length are replaced by the cropped JPEG.
+   */
+  int crop(unsigned char *&jpeg, unsigned long &length)
+  {
+    int jpeg_width, jpeg_height, subsamp;
+
+    if(tjDecompressHeader2(decompressor, jpeg, length, &jpeg_width, &jpeg_height, &subsamp) != 0)
+      return -1;
+
+    if(transformer == 0 && (transformer = tjInitTransform()) == 0)
+      return -1;
+
+    const int mcu_width = tjMCUWidth[subsamp], mcu_height = tjMCUHeight[subsamp];
+    tjtransform transform;
+    std::memset(&transform, 0, sizeof(transform));
+    transform.r.x = roi_x / mcu_width * mcu_width;
+    transform.r.y = roi_y / mcu_height * mcu_height;
+    transform.r.w = std::min(jpeg_width, (roi_x + roi_width + mcu_width - 1) / mcu_width * mcu_width) - transform.r.x;
+    transform.r.h = std::min(jpeg_height, (roi_y + roi_height + mcu_height - 1) / mcu_height * mcu_height) - transform.r.y;
+    transform.op = TJXOP_NONE;
+    transform.options = TJXOPT_CROP;
+
+    if(tjTransform(transformer, jpeg, length, 1, &cropped, &cropped_length, &transform, 0) != 0)
+      return -1;
+
+    // the MCU grid is a multiple of 8 pixels, so the region scales exactly
+    resize(transform.r.x / scale, transform.r.y / scale, transform.r.w / scale, transform.r.h / scale);
+    jpeg = cropped;
+    length = cropped_length;
+    return 0;
+  }
+
+  /** Copy the packet metadata into the frame. */
+  void setPacket(const RgbPacket &packet)
+  {
+    frame->timestamp = packet.timestamp;
+    frame->sequence = packet.sequence;
+    frame->exposure = packet.exposure;
+    frame->gain = packet.gain;
+    frame->gamma = packet.gamma;
+  }
+
+  /** Decode \a length bytes of JPEG \a data into #frame in #format. */
+  bool decode(const unsigned char *data, size_t length)
+  {
+    startTiming();
+
+    unsigned char *jpeg = const_cast<unsigned char *>(data);
+    unsigned long jpeg_length = length;
+    int r = 0;
+
+    if(roi_width < 1920 || roi_height < 1080)
+    {
+      r = crop(jpeg, jpeg_length);
+    }
+    else
+    {
+      resize(0, 0, 1920 / scale, 1080 / scale);
+    }
+
+    if(r == 0)
+    {
+      r = decompress(jpeg, jpeg_length);
+    }
+
+    if(r != 0)
+    {
+      LOG_ERROR << "Failed to decompress rgb image! TurboJPEG error: '" << tjGetErrorStr() << "'";
+    }
+
+    stopTiming(LOG_INFO);
+    return r == 0;
+  }
+
+  /** Decode the JPEG into #frame, which has the size of the JPEG divided by #scale. */
+  int decompress(unsigned char *jpeg, unsigned long length)
+  {
+    switch(format)
+    {
+    case Frame::I420:
+      return decodeI420(jpeg, length);
+    case Frame::Gray:
+      return tjDecompress2(decompressor, jpeg, length, frame->data, width, width, height, TJPF_GRAY, 0);
+    case Frame::RGB:
+      return tjDecompress2(decompressor, jpeg, length, frame->data, width, width * tjPixelSize[TJPF_RGB], height, TJPF_RGB, 0);
+    case Frame::RGBX:
+      return tjDecompress2(decompressor, jpeg, length, frame->data, width, width * tjPixelSize[TJPF_RGBX], height, TJPF_RGBX, 0);
+    default:
+      return tjDecompress2(decompressor, jpeg, length, frame->data, width, width * tjPixelSize[TJPF_BGRX], height, TJPF_BGRX, 0);
+    }
+  }
+
+  /**
+   * Size of plane \a plane of the YUV image written by tjDecompressToYUV().
+   * The planes are padded to a multiple of the chroma subsampling and each
+   * row to 4 bytes, like tjPlaneWidth() and tjPlaneHeight() of TurboJPEG 1.4
+   * with a padding of 4.
+   */
+  static void yuvPlaneSize(int plane, int jpeg_width, int jpeg_height, int subsamp, int &plane_width, int &plane_height, int &stride)
+  {
+    const int h_factor = tjMCUWidth[subsamp] / 8, v_factor = tjMCUHeight[subsamp] / 8;
+    plane_width = (jpeg_width + h_factor - 1) / h_factor * h_factor;
+    plane_height = (jpeg_height + v_factor - 1) / v_factor * v_factor;
+
+    if(plane > 0)
+    {
+      plane_width /= h_factor;
+      plane_height /= v_factor;
+    }
+
+    stride = (plane_width + 3) / 4 * 4;
+  }
+
+  /**
+   * Decode the planes of the JPEG without color conversion. Unscaled 4:2:0
+   * JPEGs whose planes have no row padding are decoded straight into the
+   * frame. Otherwise the planes are repacked, and box filtered to the frame
+   * size and the chroma planes to half of it, because tjDecompressToYUV()
+   * cannot scale. This also handles a region with an odd size clipped at the
+   * edge of the image.
+   */
+  int decodeI420(unsigned char *jpeg, size_t length)
+  {
+    int jpeg_width, jpeg_height, subsamp;
+
+    if(tjDecompressHeader2(decompressor, jpeg, length, &jpeg_width, &jpeg_height, &subsamp) != 0)
+      return -1;
+
+    if(jpeg_width != width * scale || jpeg_height != height * scale)
+    {
+      LOG_ERROR << "unexpected JPEG size " << jpeg_width << "x" << jpeg_height;
+      return -1;
+    }
+
+    // the I420 planes of the frame are (width + 1) / 2 wide without padding
+    if(subsamp == TJSAMP_420 && scale == 1 && width % 8 == 0 && height % 2 == 0)
+      return tjDecompressToYUV(decompressor, jpeg, length, frame->data, 0);
+
+    yuv.resize(tjBufSizeYUV(jpeg_width, jpeg_height, subsamp));
+
+    if(tjDecompressToYUV(decompressor, jpeg, length, &yuv[0], 0) != 0)
+      return -1;
+
+    const int half_width = (width + 1) / 2, half_height = (height + 1) / 2;
+    const unsigned char *src = &yuv[0];
+    unsigned char *dst = frame->data;
+    int plane_width, plane_height, stride;
+
+    // the luma plane may be padded past the image, only the image is resampled
+    yuvPlaneSize(0, jpeg_width, jpeg_height, subsamp, plane_width, plane_height, stride);
+    resamplePlane(src, jpeg_width, jpeg_height, stride, dst, width, height);
+    src += stride * plane_height;
+    dst += width * height;
+
+    if(subsamp == TJSAMP_GRAY)
+    {
+      std::memset(dst, 128, 2 * half_width * half_height);
+      return 0;
+    }
+
+    yuvPlaneSize(1, jpeg_width, jpeg_height, subsamp, plane_width, plane_height, stride);
+
+    for(int plane = 0; plane < 2; ++plane)
+    {
+      resamplePlane(src, plane_width, plane_height, stride, dst, half_width, half_height);
+      src += stride * plane_height;
+      dst += half_width * half_height;
+    }
+
+    return 0;
+  }
+
+  /** Box filter or replicate a plane with rows \a src_stride bytes apart to another size. */
+  static void resamplePlane(const unsigned char *src, int src_width, int src_height, int src_stride, unsigned char *dst, int dst_width, int dst_height)
+  {
+    if(src_width == dst_width && src_height == dst_height)
+    {
+      for(int y = 0; y < dst_height; ++y)
+        std::memcpy(dst + y * dst_width, src + y * src_stride, dst_width);
+      return;
+    }
+
+    for(int y = 0; y < dst_height; ++y)
+    {
+      const int y0 = y * src_height / dst_height;
+      const int y1 = std::max(y0 + 1, (y + 1) * src_height / dst_height);
+
+      for(int x = 0; x < dst_width; ++x)
+      {
+        const int x0 = x * src_width / dst_width;
+        const int x1 = std::max(x0 + 1, (x + 1) * src_width / dst_width);
+        int sum = 0;
+
+        for(int sy = y0; sy < y1; ++sy)
+          for(int sx = x0; sx < x1; ++sx)
+            sum += src[sy * src_stride + sx];
+
+        const int count = (y1 - y0) * (x1 - x0);
+        *dst++ = (unsigned char)((sum + count / 2) / count);
+      }
+    }
+  }
+
+  /** Pass the frame to \a listener, replacing it if the listener takes it. */
+  void deliver(FrameListener *listener)
+  {
+    if(listener->onNewFrame(Frame::Color, frame))
+    {
+      newFrame();
+    }
+  }
+};
+
+/**
+ * Implementation of the Turbo-Jpeg decoder processor.
+ *
+ * With more than one decoder, packets are copied to an idle decoder and
+ * decoded by a pool of worker threads, one per decoder, in any order. The
+ * frames are passed to the listener in the order of the packets. process()
+ * blocks while all decoders are busy, which bounds the packets in flight.
+ */
+class TurboJpegRgbPacketProcessorImpl
+{
+public:
+  std::vector<TurboJpegDecoder *> decoders;
+
+  int scale; ///< Frames are 1920x1080 divided by the scale, guarded by #mutex.
+  int roi_x, roi_y, roi_width, roi_height; ///< Region to decode, in pixels of the 1920x1080 image, guarded by #mutex.
+
+  bool shutdown;
+  bool delivering;           ///< Whether a thread is passing frames to listeners.
+  unsigned int next_ticket;  ///< Ticket of the next submitted packet.
+  unsigned int next_deliver; ///< Ticket of the next frame to pass to the listener.
+
+  libfreenect2::mutex mutex;
+  libfreenect2::condition_variable work_condition; ///< Signals a queued packet or shutdown.
+  libfreenect2::condition_variable idle_condition; ///< Signals an idle decoder.
+  std::vector<libfreenect2::thread *> threads;
+
+  TurboJpegRgbPacketProcessorImpl(int num_decoders) :
+    scale(1),
+    roi_x(0),
+    roi_y(0),
+    roi_width(1920),
+    roi_height(1080),
+    shutdown(false),
+    delivering(false),
+    next_ticket(0),
+    next_deliver(0)
+  {
+    if(num_decoders <= 0)
+    {
+      num_decoders = std::max(1u, libfreenect2::thread::hardware_concurrency());
+    }
+
+    for(int i = 0; i < num_decoders; ++i)
+    {
+      decoders.push_back(new TurboJpegDecoder());
+    }
+
+    if(num_decoders > 1)
+    {
+      for(int i = 0; i < num_decoders; ++i)
+      {
+        threads.push_back(new libfreenect2::thread(&TurboJpegRgbPacketProcessorImpl::static_execute, this));
+      }
+    }
+  }
+
+  ~TurboJpegRgbPacketProcessorImpl()
+  {
+    {
+      libfreenect2::lock_guard l(mutex);
+      shutdown = true;
+    }
+    work_condition.notify_all();
+
+    for(size_t i = 0; i < threads.size(); ++i)
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+
+    for(size_t i = 0; i < decoders.size(); ++i)
+    {
+      delete decoders[i];
+    }
+  }
+
+  /** Copy a packet to an idle decoder of the pool, blocks while there is none. */
+  void submit(const RgbPacket &packet, FrameListener *listener)
+  {
+    libfreenect2::unique_lock l(mutex);
+    TurboJpegDecoder *decoder = 0;
+
+    for(;;)
+    {
+      for(size_t i = 0; i < decoders.size() && decoder == 0; ++i)
+      {
+        if(decoders[i]->state == TurboJpegDecoder::Idle)
+          decoder = decoders[i];
+      }
+
+      if(decoder != 0 || shutdown)
+        break;
+
+      WAIT_CONDITION(idle_condition, mutex, l)
+    }
+
+    if(decoder == 0)
+      return;
+
+    // the decoder is idle, so no other thread touches it until it is queued
+    if(decoder->jpeg.size() < packet.jpeg_buffer_length)
+      decoder->jpeg.resize(packet.jpeg_buffer_length);
+    std::memcpy(&decoder->jpeg[0], packet.jpeg_buffer, packet.jpeg_buffer_length);
+    decoder->jpeg_length = packet.jpeg_buffer_length;
+    decoder->setFormat(listener->getFrameFormat(Frame::Color));
+    decoder->setRegion(scale, roi_x, roi_y, roi_width, roi_height);
+    decoder->setPacket(packet);
+    decoder->listener = listener;
+    decoder->ticket = next_ticket++;
+    decoder->state = TurboJpegDecoder::Queued;
+
+    work_condition.notify_one();
+  }
+
+  static void static_execute(void *data)
+  {
+    static_cast<TurboJpegRgbPacketProcessorImpl *>(data)->execute();
+  }
+
+  void execute()
+  {
+    for(;;)
+    {
+      TurboJpegDecoder *decoder = 0;
+      {
+        libfreenect2::unique_lock l(mutex);
+
+        while(!shutdown && (decoder = queuedDecoder()) == 0)
+        {
+          WAIT_CONDITION(work_condition, mutex, l)
+        }
+
+        if(shutdown) return;
+
+        decoder->state = TurboJpegDecoder::Decoding;
+      }
+
+      bool ok = decoder->decompressor != 0 && decoder->decode(&decoder->jpeg[0], decoder->jpeg_length);
+
+      {
+        libfreenect2::lock_guard l(mutex);
+        decoder->ok = ok;
+        decoder->state = TurboJpegDecoder::Decoded;
+      }
+
+      deliverInOrder();
+    }
+  }
+
+  /** The queued decoder with the oldest packet, the mutex must be held. */
+  TurboJpegDecoder *queuedDecoder()
+  {
+    TurboJpegDecoder *oldest = 0;
+
+    for(size_t i = 0; i < decoders.size(); ++i)
+    {
+      TurboJpegDecoder *decoder = decoders[i];
+
+      if(decoder->state == TurboJpegDecoder::Queued && (oldest == 0 || decoder->ticket - next_deliver < oldest->ticket - next_deliver))
+        oldest = decoder;
+    }
+
+    return oldest;
+  }
+
+  /** The decoder holding ticket #next_deliver if it is decoded, the mutex must be held. */
+  TurboJpegDecoder *nextDecoded()
+  {
+    for(size_t i = 0; i < decoders.size(); ++i)
+    {
+      if(decoders[i]->state == TurboJpegDecoder::Decoded && decoders[i]->ticket == next_deliver)
+        return decoders[i];
+    }
+
+    return 0;
+  }
+
+  /**
+   * Pass the decoded frames that are next in order to their listener. Only one
+   * thread delivers at a time, it also delivers frames decoded meanwhile.
+   */
+  void deliverInOrder()
+  {
+    {
+      libfreenect2::lock_guard l(mutex);
+
+      if(delivering)
+        return;
+
+      delivering = true;
+    }
+
+    for(;;)
+    {
+      TurboJpegDecoder *decoder;
+      {
+        libfreenect2::lock_guard l(mutex);
+
+        // checked and cleared under one lock, so a frame decoded meanwhile is not missed
+        decoder = nextDecoded();
+        if(decoder == 0)
+        {
+          delivering = false;
+          return;
+        }
+      }
+
+      // the decoder stays Decoded until it is delivered, so no other thread touches it
+      if(decoder->ok)
+        decoder->deliver(decoder->listener);
+
+      {
+        libfreenect2::lock_guard l(mutex);
+        decoder->state = TurboJpegDecoder::Idle;
+        next_deliver++;
+      }
+      idle_condition.notify_one();
+    }
   }
 };
 
-TurboJpegRgbPacketProcessor::TurboJpegRgbPacketProcessor() :
-    impl_(new TurboJpegRgbPacketProcessorImpl())
+TurboJpegRgbPacketProcessor::TurboJpegRgbPacketProcessor(const int num_decoders) :
+    impl_(new TurboJpegRgbPacketProcessorImpl(num_decoders))
 {
 }
 
@@ -82,33 +663,65 @@ TurboJpegRgbPacketProcessor::~TurboJpegRgbPacketProcessor()
   delete impl_;
 }
 
+void TurboJpegRgbPacketProcessor::setConfiguration(const libfreenect2::Freenect2Device::Config &config)
+{
+  // clip the region to the image, an empty region selects the whole image
+  int x = config.ColorRoiX, y = config.ColorRoiY;
+  int x_end = std::min(x + std::max(config.ColorRoiWidth, 0), 1920), y_end = std::min(y + std::max(config.ColorRoiHeight, 0), 1080);
+  x = std::max(x, 0);
+  y = std::max(y, 0);
+
+  if(x >= x_end || y >= y_end)
+  {
+    x = 0;
+    y = 0;
+    x_end = 1920;
+    y_end = 1080;
+  }
+
+  // packets are submitted on the processor thread
+  libfreenect2::lock_guard l(impl_->mutex);
+
+  // Freenect2Device validates the downscale, it is 1, 2, 4 or 8
+  impl_->scale = config.ColorDownscale;
+  impl_->roi_x = x;
+  impl_->roi_y = y;
+  impl_->roi_width = x_end - x;
+  impl_->roi_height = y_end - y;
+}
+
 void TurboJpegRgbPacketProcessor::process(const RgbPacket &packet)
 {
-  if(impl_->decompressor != 0 && listener_ != 0)
+  if(listener_ == 0 || !listener_->wantsFrameType(Frame::Color))
+    return;
+
+  if(listener_->getFrameFormat(Frame::Color) == Frame::Raw)
   {
-    impl_->startTiming();
+    deliverRaw(packet);
+    return;
+  }
 
-    impl_->frame->timestamp = packet.timestamp;
-    impl_->frame->sequence = packet.sequence;
-    impl_->frame->exposure = packet.exposure;
-    impl_->frame->gain = packet.gain;
-    impl_->frame->gamma = packet.gamma;
+  if(!impl_->threads.empty())
+  {
+    impl_->submit(packet, listener_);
+    return;
+  }
 
-    int r = tjDecompress2(impl_->decompressor, packet.jpeg_buffer, packet.jpeg_buffer_length, impl_->frame->data, 1920, 1920 * tjPixelSize[TJPF_BGRX], 1080, TJPF_BGRX, 0);
+  TurboJpegDecoder *decoder = impl_->decoders[0];
 
-    if(r == 0)
+  if(decoder->decompressor != 0)
+  {
+    decoder->setFormat(listener_->getFrameFormat(Frame::Color));
     {
-      if(listener_->onNewFrame(Frame::Color, impl_->frame))
-      {
-        impl_->newFrame();
-      }
+      libfreenect2::lock_guard l(impl_->mutex);
+      decoder->setRegion(impl_->scale, impl_->roi_x, impl_->roi_y, impl_->roi_width, impl_->roi_height);
     }
-    else
+    decoder->setPacket(packet);
+
+    if(decoder->decode(packet.jpeg_buffer, packet.jpeg_buffer_length))
     {
-      LOG_ERROR << "Failed to decompress rgb image! TurboJPEG error: '" << tjGetErrorStr() << "'";
+      decoder->deliver(listener_);
     }
-
-    impl_->stopTiming(LOG_INFO);
   }
 }
 